@@ -0,0 +1,207 @@
+#include "Clock.h"
+
+#ifndef IOTCONNECT_NO_CLOCK
+
+#include "Log.h"
+#include "Config.h"
+#include <atomic>
+
+static char reqTopic[MQTT_TOPIC_MAX];   // <publicId>/clock/req
+static char resTopic[MQTT_TOPIC_MAX];   // <publicId>/clock/res
+static bool enabled = false;
+static uint32_t interval = 0;
+
+// Ronda de sincronización en curso
+static bool waiting = false;
+static uint32_t pendingT0 = 0;
+static uint8_t roundSamples = 0;        // Ecos respondidos o vencidos
+static uint32_t bestRtt = UINT32_MAX;
+static uint32_t bestOffset = 0;
+static unsigned long lastRequest = 0;
+static unsigned long lastSync = 0;
+
+// Hora del servidor (32 bits bajos) = millis() + offset
+static volatile bool synced = false;
+static volatile uint32_t offset = 0;
+static LatencyStats stats = {};
+static uint64_t latencySum = 0;
+static std::atomic<uint32_t> statsSeq{0};   // Impar mientras se escriben stats
+
+static constexpr uint8_t CLOCK_ROUND = 4;
+static constexpr unsigned long CLOCK_SPACING_MS = 250;   // Entre ecos de una ronda
+static constexpr unsigned long CLOCK_TIMEOUT_MS = 3000;
+static constexpr unsigned long CLOCK_RETRY_MS = 30000;   // Sin sincronizar aún
+static constexpr size_t STAMP_LEN = 10;                  // "@xxxxxxxx|"
+static constexpr size_t T0_LEN = 10;                     // millis() con ceros delante
+
+// Seqlock: escribe el task de MQTT, clockStats() lee desde cualquiera
+static void beginStats() {
+  statsSeq.store(statsSeq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void endStats() {
+  statsSeq.store(statsSeq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+static void finishRound() {
+  if (bestRtt != UINT32_MAX) {
+    offset = bestOffset;
+    beginStats();
+    stats.rttMs = bestRtt;
+    stats.syncs++;
+    stats.synced = true;
+    endStats();
+    IOT_LOGF("[CLK] Sincronizado: rtt %lu ms\n", (unsigned long)bestRtt);
+    synced = true;
+  } else {
+    IOT_LOG("[CLK] Sin respuesta del servidor");
+  }
+  roundSamples = 0;
+  bestRtt = UINT32_MAX;
+  lastSync = millis();
+}
+
+bool clockBegin(const char* publicId, uint32_t intervalMs) {
+  int len = snprintf(reqTopic, sizeof(reqTopic), "%s/clock/req", publicId);
+  if (len < 0 || (size_t)len >= sizeof(reqTopic)) return false;
+  snprintf(resTopic, sizeof(resTopic), "%s/clock/res", publicId);
+  interval = intervalMs;
+  enabled = true;
+  return mqttSubscribe(resTopic, 0);
+}
+
+bool clockHandle(const char* topic, const uint8_t* payload, size_t length) {
+  if (!enabled || strcmp(topic, resTopic) != 0) return false;
+  uint32_t t3 = millis();
+
+  char text[32];
+  if (length >= sizeof(text)) return true;
+  memcpy(text, payload, length);
+  text[length] = '\0';
+
+  char* end;
+  uint32_t t0 = strtoul(text, &end, 10);
+  if (*end != '|' || !waiting || t0 != pendingT0) return true;  // Tardío o ajeno
+  uint32_t server = (uint32_t)strtoull(end + 1, nullptr, 10);
+
+  // El servidor puso su hora a mitad del viaje (asumiendo ida = vuelta)
+  uint32_t rtt = t3 - t0;
+  if (rtt < bestRtt) {
+    bestRtt = rtt;
+    bestOffset = server - (t0 + rtt / 2);
+  }
+  waiting = false;
+  if (++roundSamples >= CLOCK_ROUND) finishRound();
+  return true;
+}
+
+// t0 se toma al escribir el payload en el socket, no antes de las esperas
+// de la publicación
+static size_t writeRequest(Print& out) {
+  char text[T0_LEN + 1];
+  pendingT0 = millis();
+  snprintf(text, sizeof(text), "%010lu", (unsigned long)pendingT0);
+  return out.write((const uint8_t*)text, T0_LEN);
+}
+
+void clockService() {
+  if (!enabled) return;
+  unsigned long now = millis();
+
+  if (waiting) {
+    if (now - lastRequest < CLOCK_TIMEOUT_MS) return;
+    waiting = false;
+    if (++roundSamples >= CLOCK_ROUND) finishRound();
+  }
+
+  if (roundSamples > 0) {
+    if (now - lastRequest < CLOCK_SPACING_MS) return;
+  } else if (lastSync && now - lastSync < (synced ? interval : CLOCK_RETRY_MS)) {
+    return;
+  }
+
+  // La respuesta la recoge clockHandle() desde la lectura normal de MQTT
+  lastRequest = now;
+  if (!mqttPublishStream(reqTopic, T0_LEN, writeRequest)) return;
+  waiting = true;
+}
+
+bool clockWaiting() {
+  return waiting;
+}
+
+void clockReceive(const uint8_t*& payload, unsigned int& length) {
+  if (!enabled || length < STAMP_LEN || payload[0] != '@' || payload[STAMP_LEN - 1] != '|') return;
+
+  char hex[9];
+  memcpy(hex, payload + 1, 8);
+  hex[8] = '\0';
+  char* end;
+  uint32_t sent = strtoul(hex, &end, 16);
+  if (end != hex + 8) return;  // No es una marca: se entrega tal cual
+  payload += STAMP_LEN;
+  length -= STAMP_LEN;
+  if (!synced) return;
+
+  // Un desfase de unos ms puede dar latencias negativas: cuentan como 0
+  int32_t diff = (int32_t)((uint32_t)millis() + offset - sent);
+  uint32_t latency = diff > 0 ? diff : 0;
+
+  size_t bucket = 0;
+  while (bucket < LATENCY_BUCKETS - 1 && latency >= (1UL << bucket)) bucket++;
+  beginStats();
+  stats.buckets[bucket]++;
+  if (stats.samples == 0 || latency < stats.minMs) stats.minMs = latency;
+  if (latency > stats.maxMs) stats.maxMs = latency;
+  stats.samples++;
+  latencySum += latency;
+  endStats();
+}
+
+void clockStamp(MqttMessage& msg) {
+  if (!enabled || !synced || msg.length + STAMP_LEN > MQTT_PAYLOAD_MAX) return;
+  memmove(msg.payload + STAMP_LEN, msg.payload, msg.length + 1);
+  char stamp[STAMP_LEN + 1];
+  snprintf(stamp, sizeof(stamp), "@%08lx|", (unsigned long)((uint32_t)millis() + offset));
+  memcpy(msg.payload, stamp, STAMP_LEN);
+  msg.length += STAMP_LEN;
+}
+
+bool clockSynced() {
+  return synced;
+}
+
+static uint32_t percentile(const LatencyStats& s, uint32_t percent) {
+  uint64_t target = ((uint64_t)s.samples * percent + 99) / 100;
+  uint64_t seen = 0;
+  for (size_t i = 0; i < LATENCY_BUCKETS; i++) {
+    seen += s.buckets[i];
+    if (seen >= target) return i < LATENCY_BUCKETS - 1 ? (1UL << i) : s.maxMs;
+  }
+  return s.maxMs;
+}
+
+LatencyStats clockStats() {
+  LatencyStats s;
+  uint64_t sum;
+  for (;;) {
+    uint32_t seq = statsSeq.load(std::memory_order_acquire);
+    if (seq & 1) {
+      delay(1);  // Deja terminar al que escribe aunque tenga menos prioridad
+      continue;
+    }
+    s = stats;
+    sum = latencySum;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (statsSeq.load(std::memory_order_relaxed) == seq) break;
+  }
+  if (s.samples > 0) {
+    s.meanMs = sum / s.samples;
+    s.p50Ms = percentile(s, 50);
+    s.p95Ms = percentile(s, 95);
+  }
+  return s;
+}
+
+#endif  // IOTCONNECT_NO_CLOCK
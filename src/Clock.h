@@ -0,0 +1,74 @@
+#pragma once
+#include <Arduino.h>
+#include "MqttClient.h"
+
+// =============================================================================
+// Clock - Reloj del servidor y latencia extremo a extremo
+// =============================================================================
+// El broker no pone hora a los mensajes: un servicio en el servidor responde
+// al eco con la suya. Topics (p = publicId):
+//
+//   p/clock/req   "<t0>"                 millis() del dispositivo al escribir
+//                                        en el socket (10 cifras)
+//   p/clock/res   "<t0>|<ms unix>"       Respuesta del servidor
+//
+// Cada sincronización son CLOCK_ROUND ecos y se queda el de menor ida y
+// vuelta (el punto medio es más fiable cuanto más corta). Con el reloj
+// sincronizado, los mensajes de la app llevan delante "@<ms>|", con los 32
+// bits bajos de la hora del servidor en hexadecimal (8 cifras), y los que
+// llegan con esa marca registran su latencia y se entregan sin ella.
+//
+// Se ejecuta en el task que atiende MQTT; las estadísticas se leen desde
+// cualquier task (seqlock, como LatestValues).
+// =============================================================================
+
+// Histograma en potencias de 2: [0] < 1 ms, [i] < 2^i ms, el último el resto
+constexpr size_t LATENCY_BUCKETS = 16;
+
+struct LatencyStats {
+  bool synced;           // Hay desfase con el servidor
+  uint32_t syncs;        // Sincronizaciones completadas
+  uint32_t rttMs;        // Ida y vuelta del eco elegido en la última
+  uint32_t samples;      // Mensajes recibidos con marca
+  uint32_t minMs;
+  uint32_t maxMs;
+  uint32_t meanMs;
+  uint32_t p50Ms;        // Límite superior del tramo del histograma
+  uint32_t p95Ms;
+  uint32_t buckets[LATENCY_BUCKETS];
+};
+
+#ifdef IOTCONNECT_NO_CLOCK
+// Reloj desactivado en compilación: no se enlaza nada de Clock.cpp
+inline bool clockBegin(const char*, uint32_t) { return false; }
+inline bool clockHandle(const char*, const uint8_t*, size_t) { return false; }
+inline void clockReceive(const uint8_t*&, unsigned int&) {}
+inline void clockStamp(MqttMessage&) {}
+inline void clockService() {}
+inline bool clockWaiting() { return false; }
+inline bool clockSynced() { return false; }
+inline LatencyStats clockStats() { return LatencyStats{}; }
+#else
+// Suscribe a p/clock/res y sincroniza cada intervalMs
+bool clockBegin(const char* publicId, uint32_t intervalMs);
+
+// Respuesta al eco (true si lo era). Llamar al recibir, antes de encolar.
+bool clockHandle(const char* topic, const uint8_t* payload, size_t length);
+
+// Quita la marca de un mensaje recibido y registra su latencia
+void clockReceive(const uint8_t*& payload, unsigned int& length);
+
+// Añade la marca a un mensaje saliente (si hay reloj y cabe)
+void clockStamp(MqttMessage& msg);
+
+// Envía los ecos pendientes (llamar con la conexión estable). No espera la
+// respuesta: la recoge clockHandle() en la siguiente lectura de MQTT.
+void clockService();
+
+// Hay un eco sin respuesta: conviene leer MQTT cuanto antes, porque la espera
+// hasta la lectura cuenta como ida y vuelta
+bool clockWaiting();
+
+bool clockSynced();
+LatencyStats clockStats();
+#endif
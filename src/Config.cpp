@@ -1,4 +1,7 @@
 #include "Config.h"
+#include "Log.h"
+#include "Trace.h"
+#include "Shadow.h"
 #include <Preferences.h>
 #include <cstring>
 
@@ -14,14 +17,15 @@ static const char* NAMESPACE = "iotconnect";
 void setPortalNames(const char* apName, const char* appName) {
   g_apName = apName;
   g_appName = appName;
-  Serial.printf("[CFG] Portal configurado: AP='%s', App='%s'\n", g_apName, g_appName);
+  IOT_LOGF("[CFG] Portal configurado: AP='%s', App='%s'\n", g_apName, g_appName);
 }
 
 bool loadConfig(AppConfig& cfg) {
-  Serial.println("[CFG] Cargando configuración desde NVS");
+  IOT_TRACE("config.load");
+  IOT_LOG("[CFG] Cargando configuración desde NVS");
   
   if (!prefs.begin(NAMESPACE, true)) {
-    Serial.println("[CFG] Error abriendo NVS para lectura");
+    IOT_LOG("[CFG] Error abriendo NVS para lectura");
     return false;
   }
 
@@ -34,17 +38,17 @@ bool loadConfig(AppConfig& cfg) {
 
   prefs.end();
 
-  Serial.printf("[CFG] Config cargada: ssid='%s', clientId='%s', publicId='%s', confirmed=%s\n",
+  IOT_LOGF("[CFG] Config cargada: ssid='%s', clientId='%s', publicId='%s', confirmed=%s\n",
                 cfg.ssid, cfg.clientId, cfg.publicId, cfg.confirmed ? "true" : "false");
   
   return true;
 }
 
 bool saveConfig(const AppConfig& cfg) {
-  Serial.println("[CFG] Guardando configuración en NVS");
+  IOT_LOG("[CFG] Guardando configuración en NVS");
   
   if (!prefs.begin(NAMESPACE, false)) {
-    Serial.println("[CFG] Error abriendo NVS para escritura");
+    IOT_LOG("[CFG] Error abriendo NVS para escritura");
     return false;
   }
 
@@ -59,26 +63,28 @@ bool saveConfig(const AppConfig& cfg) {
   prefs.end();
 
   if (success) {
-    Serial.println("[CFG] Configuración guardada exitosamente");
+    IOT_LOG("[CFG] Configuración guardada exitosamente");
   } else {
-    Serial.println("[CFG] Error guardando configuración");
+    IOT_LOG("[CFG] Error guardando configuración");
   }
 
   return success;
 }
 
 void clearConfig() {
-  Serial.println("[CFG] Limpiando configuración NVS");
+  IOT_LOG("[CFG] Limpiando configuración NVS");
   
   if (!prefs.begin(NAMESPACE, false)) {
-    Serial.println("[CFG] Error abriendo NVS para limpiar");
+    IOT_LOG("[CFG] Error abriendo NVS para limpiar");
     return;
   }
 
   prefs.clear();
   prefs.end();
 
+  // El estado del dispositivo era de la cuenta anterior
+  shadowClear();
   memset(&g_cfg, 0, sizeof(g_cfg));
   
-  Serial.println("[CFG] Configuración limpiada");
+  IOT_LOG("[CFG] Configuración limpiada");
 }
@@ -1,12 +1,16 @@
 #pragma once
 #include <Arduino.h>
 
+#ifndef IOTCONNECT_CONFIG_FIELD_MAX
+#define IOTCONNECT_CONFIG_FIELD_MAX 64
+#endif
+
 struct AppConfig {
-  char ssid[64];
-  char pass[64];
-  char clientId[64];
-  char token[64];
-  char publicId[64];
+  char ssid[IOTCONNECT_CONFIG_FIELD_MAX];
+  char pass[IOTCONNECT_CONFIG_FIELD_MAX];
+  char clientId[IOTCONNECT_CONFIG_FIELD_MAX];
+  char token[IOTCONNECT_CONFIG_FIELD_MAX];
+  char publicId[IOTCONNECT_CONFIG_FIELD_MAX];
   bool confirmed;
 };
 
@@ -17,9 +21,185 @@ bool loadConfig(AppConfig& cfg);
 bool saveConfig(const AppConfig& cfg);
 void clearConfig();
 
-// Constantes MQTT (puedes cambiarlas según tu servidor)
-constexpr const char* MQTT_HOST = "joseaveleira.es";
-constexpr uint16_t    MQTT_PORT = 1883;
+// =============================================================================
+// Funciones opcionales y capacidades (ajustables en compilación)
+// =============================================================================
+// Se definen desde platformio.ini, por ejemplo:
+//
+//   build_flags = -DIOTCONNECT_NO_PORTAL -DIOTCONNECT_MQTT_BUFFER_SIZE=512
+//
+// Funciones:
+//   IOTCONNECT_NO_PORTAL     Sin portal cautivo (ni WebServer, DNSServer ni
+//                            HTML). Credenciales con IoTConnect.setCredentials()
+//   IOTCONNECT_NO_LOG        Sin trazas por Serial
+//   IOTCONNECT_NO_RPC        Sin RPC (onRpc/call no hacen nada)
+//   IOTCONNECT_NO_SHADOW     Sin estado del dispositivo (setState/onDesired)
+//   IOTCONNECT_NO_OTA        Sin OTA por MQTT (enableOta no hace nada)
+//   IOTCONNECT_NO_CLOCK      Sin reloj ni latencia (enableLatencyTracking)
+//   IOTCONNECT_NO_OUTBOX     Sin colas de salida: publish() envía en el acto
+//                            (incompatible con enableNetworkTask)
+//   IOTCONNECT_TLS           MQTT sobre TLS (WiFiClientSecure, puerto 8883)
+//   IOTCONNECT_STATIC_ALLOC  Sin heap tras begin() (ver IoTConnect.h)
+//   IOTCONNECT_TRACE         Tramos de tiempo de arranque/conexión (Trace.h)
+// =============================================================================
+
+// (IOTCONNECT_CONFIG_FIELD_MAX, tamaño de cada campo de AppConfig, arriba)
+
+#ifndef IOTCONNECT_MQTT_HOST
+#define IOTCONNECT_MQTT_HOST "joseaveleira.es"
+#endif
+#ifndef IOTCONNECT_MQTT_PORT
+#ifdef IOTCONNECT_TLS
+#define IOTCONNECT_MQTT_PORT 8883
+#else
+#define IOTCONNECT_MQTT_PORT 1883
+#endif
+#endif
+#ifndef IOTCONNECT_MQTT_BUFFER_SIZE
+#define IOTCONNECT_MQTT_BUFFER_SIZE 1024
+#endif
+#ifndef IOTCONNECT_MQTT_KEEPALIVE
+#define IOTCONNECT_MQTT_KEEPALIVE 60
+#endif
+#ifndef IOTCONNECT_MAX_SUBSCRIPTIONS
+#define IOTCONNECT_MAX_SUBSCRIPTIONS 16
+#endif
+#ifndef IOTCONNECT_MAX_CONNECTIONS
+#define IOTCONNECT_MAX_CONNECTIONS 2
+#endif
+#ifndef IOTCONNECT_MAX_ROUTES
+#define IOTCONNECT_MAX_ROUTES 4
+#endif
+#ifndef IOTCONNECT_TOPIC_MAX
+#define IOTCONNECT_TOPIC_MAX 128
+#endif
+#ifndef IOTCONNECT_PAYLOAD_MAX
+#define IOTCONNECT_PAYLOAD_MAX 512
+#endif
+#ifndef IOTCONNECT_TOPIC_HANDLES
+#define IOTCONNECT_TOPIC_HANDLES 8
+#endif
+#ifndef IOTCONNECT_LATEST_SLOTS
+#define IOTCONNECT_LATEST_SLOTS 8
+#endif
+#ifndef IOTCONNECT_LATEST_PAYLOAD_MAX
+#define IOTCONNECT_LATEST_PAYLOAD_MAX 128
+#endif
+#ifndef IOTCONNECT_TELEMETRY_CHANNELS
+#define IOTCONNECT_TELEMETRY_CHANNELS 4
+#endif
+#ifndef IOTCONNECT_RPC_METHODS
+#define IOTCONNECT_RPC_METHODS 8
+#endif
+#ifndef IOTCONNECT_RPC_PENDING
+#define IOTCONNECT_RPC_PENDING 4
+#endif
+#ifndef IOTCONNECT_JSON_DOC_SIZE
+#define IOTCONNECT_JSON_DOC_SIZE 512
+#endif
+#ifndef IOTCONNECT_JSON_FILTER_SIZE
+#define IOTCONNECT_JSON_FILTER_SIZE 128
+#endif
+#ifndef IOTCONNECT_SHADOW_KEYS
+#define IOTCONNECT_SHADOW_KEYS 8
+#endif
+#ifndef IOTCONNECT_SHADOW_VALUE_MAX
+#define IOTCONNECT_SHADOW_VALUE_MAX 32
+#endif
+#ifndef IOTCONNECT_OUTBOX_QUEUE_LEN
+#define IOTCONNECT_OUTBOX_QUEUE_LEN 8
+#endif
+#ifndef IOTCONNECT_INBOUND_QUEUE_LEN
+#define IOTCONNECT_INBOUND_QUEUE_LEN 8
+#endif
+#ifndef IOTCONNECT_TRACE_EVENTS
+#define IOTCONNECT_TRACE_EVENTS 64
+#endif
+#ifndef IOTCONNECT_SCAN_MAX_NETWORKS
+#define IOTCONNECT_SCAN_MAX_NETWORKS 20
+#endif
+
+// Servidor MQTT
+constexpr const char* MQTT_HOST = IOTCONNECT_MQTT_HOST;
+constexpr uint16_t    MQTT_PORT = IOTCONNECT_MQTT_PORT;
+
+// Buffer de PubSubClient (también limita el tamaño de un SUBSCRIBE agrupado)
+constexpr uint16_t MQTT_BUFFER_SIZE = IOTCONNECT_MQTT_BUFFER_SIZE;
+
+// Keepalive del CONNECT (s). Los PINGREQ los decide la librería: sin
+// tráfico, con un intervalo aprendido entre PING_MIN y 3/4 del keepalive;
+// si se envía y no llega nada, se sondea a los PROBE_DELAY (un sondeo por
+// intervalo, salvo que el anterior se quedara sin respuesta). Sin PINGRESP
+// en PING_TIMEOUT la conexión se da por muerta.
+constexpr uint16_t MQTT_KEEPALIVE       = IOTCONNECT_MQTT_KEEPALIVE;
+constexpr uint32_t MQTT_PING_START_MS   = 60000;
+constexpr uint32_t MQTT_PING_MIN_MS     = 15000;
+constexpr uint32_t MQTT_PING_STEP_MS    = 15000;
+constexpr uint32_t MQTT_PING_TIMEOUT_MS = 5000;
+constexpr uint32_t MQTT_PROBE_DELAY_MS  = 5000;
+
+// Suscripciones recordadas para re-suscribir tras reconectar
+constexpr size_t MQTT_MAX_SUBSCRIPTIONS = IOTCONNECT_MAX_SUBSCRIPTIONS;   // Por conexión
+
+// Conexiones al broker (la 0 es la principal) y reglas de enrutado por prefijo
+constexpr size_t MQTT_MAX_CONNECTIONS = IOTCONNECT_MAX_CONNECTIONS;
+constexpr size_t MQTT_MAX_ROUTES      = IOTCONNECT_MAX_ROUTES;
+
+// Tamaños máximos de los mensajes que se encolan entre tasks
+constexpr size_t MQTT_TOPIC_MAX   = IOTCONNECT_TOPIC_MAX;
+constexpr size_t MQTT_PAYLOAD_MAX = IOTCONNECT_PAYLOAD_MAX;
+
+// Topics registrados con IoTConnect.topic()
+constexpr size_t MQTT_TOPIC_HANDLES = IOTCONNECT_TOPIC_HANDLES;
+
+// Publicación conflacionada (IoTConnect.publishLatest): topics y tamaño
+constexpr size_t MQTT_LATEST_SLOTS       = IOTCONNECT_LATEST_SLOTS;
+constexpr size_t MQTT_LATEST_PAYLOAD_MAX = IOTCONNECT_LATEST_PAYLOAD_MAX;
+
+// Comandos JSON (IoTConnect.onJson): documento donde se interpretan (nodos y
+// cadenas de los campos del filtro) y documento del filtro
+constexpr size_t JSON_DOC_SIZE    = IOTCONNECT_JSON_DOC_SIZE;
+constexpr size_t JSON_FILTER_SIZE = IOTCONNECT_JSON_FILTER_SIZE;
+
+// Canales de telemetría agregada (IoTConnect.addTelemetry) y cada cuántos
+// registros Delta se repite uno absoluto
+constexpr size_t  TELEMETRY_CHANNELS = IOTCONNECT_TELEMETRY_CHANNELS;
+constexpr uint8_t TELEMETRY_KEYFRAME = 16;
+
+// RPC sobre MQTT: métodos registrables, llamadas en curso y largo del nombre
+constexpr size_t RPC_METHODS    = IOTCONNECT_RPC_METHODS;
+constexpr size_t RPC_PENDING    = IOTCONNECT_RPC_PENDING;
+constexpr size_t RPC_METHOD_MAX = 32;
+
+// Shadow (IoTConnect.setState): claves y largo de clave y valor
+constexpr size_t SHADOW_KEYS      = IOTCONNECT_SHADOW_KEYS;
+constexpr size_t SHADOW_KEY_MAX   = 24;
+constexpr size_t SHADOW_VALUE_MAX = IOTCONNECT_SHADOW_VALUE_MAX;
+
+// Trozos de firmware OTA que el servidor puede enviar sin esperar "ack"
+#ifndef IOTCONNECT_OTA_WINDOW
+#define IOTCONNECT_OTA_WINDOW 4
+#endif
+constexpr uint8_t OTA_WINDOW = IOTCONNECT_OTA_WINDOW;
+
+// Cola de salida por prioridad (Outbox)
+constexpr size_t OUTBOX_QUEUE_LEN = IOTCONNECT_OUTBOX_QUEUE_LEN;   // Por clase, potencia de 2
+constexpr size_t OUTBOX_BURST     = 4;   // Máx. mensajes enviados por loop()
+constexpr size_t OUTBOX_PARKED    = 2;   // Apartados por conexión caída, potencia de 2
+
+// Cola de mensajes recibidos (se entregan en IoTConnect.loop())
+constexpr size_t MQTT_INBOUND_QUEUE_LEN = IOTCONNECT_INBOUND_QUEUE_LEN;   // Potencia de 2
+
+// Task de red opcional (IoTConnect.enableNetworkTask)
+constexpr size_t   NET_QUEUE_LEN      = 8;     // (Des)suscripciones encoladas (potencia de 2)
+constexpr uint32_t NET_TASK_STACK     = 8192;
+constexpr uint8_t  NET_TASK_PRIORITY  = 2;
+
+// Tramos que guarda IOTCONNECT_TRACE (potencia de 2)
+constexpr size_t TRACE_EVENTS = IOTCONNECT_TRACE_EVENTS;
+
+// Redes que muestra el portal
+constexpr int SCAN_MAX_NETWORKS = IOTCONNECT_SCAN_MAX_NETWORKS;
 
 // Nombres del portal (configurables desde IoTConnect)
 extern const char* g_apName;
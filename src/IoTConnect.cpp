@@ -1,87 +1,169 @@
 #include "IoTConnect.h"
+#include "Log.h"
 #include "Config.h"
 #include "Portal.h"
 #include "Net.h"
 #include "MqttClient.h"
+#include "RingBuffer.h"
+#include "LatestValues.h"
+#include "Outbox.h"
+#include "Telemetry.h"
+#include "Ota.h"
+#include "Trace.h"
+#include "Rpc.h"
+#include "Shadow.h"
+#include "Clock.h"
 
 // Instancia global singleton
 IoTConnectClass IoTConnect;
 
+// Colas entre el task de red y el de la app. inboundQueue (y el Outbox para
+// las publicaciones) se usan siempre; controlQueue y connectionEvents solo
+// con enableNetworkTask.
+enum class ControlType : uint8_t { Subscribe, Unsubscribe, PublishTrace, ConfirmDelivery };
+
+struct ControlItem {
+  ControlType type;
+  uint8_t qos;
+  char topic[MQTT_TOPIC_MAX];
+};
+
+static RingBuffer<ControlItem, NET_QUEUE_LEN> controlQueue;     // app -> red
+static RingBuffer<MqttMessage, MQTT_INBOUND_QUEUE_LEN> inboundQueue;  // red -> app
+static RingBuffer<bool, 4> connectionEvents;                    // red -> app
+
+// Comandos JSON (onJson): un documento basta porque la entrega es secuencial
+static StaticJsonDocument<JSON_DOC_SIZE> jsonDoc;
+static StaticJsonDocument<JSON_FILTER_SIZE> jsonFilter;
+static bool jsonFiltered = false;
+static char jsonTopic[MQTT_TOPIC_MAX];          // Vacío = todos los topics
+
+// Filtro MQTT con + y # contra un topic concreto
+static bool topicMatches(const char* filter, const char* topic) {
+  while (*filter) {
+    if (*filter == '#') return true;
+    if (*filter == '+') {
+      while (*topic && *topic != '/') topic++;
+      filter++;
+      continue;
+    }
+    if (*filter != *topic) {
+      // "a/#" también vale para "a"
+      return !*topic && filter[0] == '/' && filter[1] == '#' && !filter[2];
+    }
+    filter++;
+    topic++;
+  }
+  return !*topic;
+}
+
+#ifdef IOTCONNECT_TRACE
+// Print que solo cuenta bytes: el PUBLISH necesita la longitud por adelantado
+class CountingPrint : public Print {
+public:
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t*, size_t size) override { return size; }
+};
+
+static bool publishTraceNow(const char* topic) {
+  traceSetPaused(true);  // Longitud y contenido tienen que coincidir
+  CountingPrint counter;
+  bool ok = mqttPublishStream(topic, traceDump(counter), traceDump);
+  traceSetPaused(false);
+  return ok;
+}
+#endif
+
+// Topics completos registrados con topic()
+static char topicHandles[MQTT_TOPIC_HANDLES][MQTT_TOPIC_MAX];
+static size_t topicHandleCount = 0;
+
+void IoTConnectClass::enableNetworkTask(uint8_t core) {
+  if (_initialized) {
+    IOT_LOG("[IOT] enableNetworkTask() debe llamarse antes de begin()");
+    return;
+  }
+#ifdef IOTCONNECT_NO_OUTBOX
+  // Sin Outbox se publica desde el task de la app: el socket sería de los dos
+  (void)core;
+  IOT_LOG("[IOT] enableNetworkTask() no está disponible con IOTCONNECT_NO_OUTBOX");
+  return;
+#endif
+  _useNetworkTask = true;
+  _networkCore = core;
+}
+
 void IoTConnectClass::begin(const char* apName, const char* appName) {
+  IOT_TRACE("begin");
   _apName = apName;
   _appName = appName;
   _initialized = true;
   bool justConfigured = false;  // Flag para saber si viene del portal
   
   Serial.begin(115200);
-  Serial.printf("\n=== %s IoT Connect v1.0 ===\n", _appName);
+  IOT_LOGF("\n=== %s IoT Connect v1.0 ===\n", _appName);
   
   setPortalNames(_apName, _appName);
   loadConfig(g_cfg);
   
+  setMqttMessageCallback([](const char* topic, const uint8_t* payload, unsigned int length) {
+    IoTConnect.handleIncoming(topic, payload, length);
+  });
+  setMqttReadGate(canReadInbound);
+  
+  // Credenciales fijadas por código: se guardan si han cambiado
+  if (_hasCredentials && memcmp(&_credentials, &g_cfg, sizeof(g_cfg)) != 0) {
+    g_cfg = _credentials;
+    saveConfig(g_cfg);
+    justConfigured = true;
+  }
+  
   if (!g_cfg.confirmed) {
     justConfigured = true;  // Primera configuración
-    enterPortalMode();
-    while (!g_cfg.confirmed) {
-      handlePortalLoop();
-      delay(10);
-    }
-    stopPortal();
+    runPortalUntilConfigured(false);
   }
   
-  Serial.println("[IOT] Conectando WiFi...");
+  IOT_LOG("[IOT] Conectando WiFi...");
   if (!connectWifi(g_cfg)) {
-    Serial.println("[NET] WiFi falló, volviendo a portal");
-    clearConfig();
-    memset(&g_cfg, 0, sizeof(g_cfg));
-    
+    IOT_LOG("[NET] WiFi falló, volviendo a portal");
     justConfigured = true;  // Reconfiguración
-    enterPortalMode();
-    while (!g_cfg.confirmed) {
-      handlePortalLoop();
-      delay(10);
-    }
-    stopPortal();
+    runPortalUntilConfigured(true);
     
     if (!connectWifi(g_cfg)) {
-      Serial.println("[NET] WiFi falló nuevamente, reiniciando...");
+      IOT_LOG("[NET] WiFi falló nuevamente, reiniciando...");
       ESP.restart();
     }
   }
   
   mqttBegin();
-  Serial.println("[IOT] Conectando MQTT...");
+  strlcpy(_servicesPublicId, g_cfg.publicId, sizeof(_servicesPublicId));
+  if (_otaEnabled) otaBegin(g_cfg.publicId);
+  if (_clockSyncMs) clockBegin(g_cfg.publicId, _clockSyncMs);
+  IOT_LOG("[IOT] Conectando MQTT...");
   _mqttFailCount = 0;
   
   while (!mqttConnect(g_cfg)) {
     _mqttFailCount++;
     
     if (_mqttFailCount >= 4) {
-      Serial.println("[MQTT] 4 fallos, volviendo a portal");
-      clearConfig();
-      memset(&g_cfg, 0, sizeof(g_cfg));
-      
+      IOT_LOG("[MQTT] 4 fallos, volviendo a portal");
       justConfigured = true;  // Reconfiguración tras fallo MQTT
-      enterPortalMode();
-      while (!g_cfg.confirmed) {
-        handlePortalLoop();
-        delay(10);
-      }
-      stopPortal();
+      runPortalUntilConfigured(true);
       
       if (!connectWifi(g_cfg)) {
         ESP.restart();
       }
       _mqttFailCount = 0;
     } else {
-      Serial.printf("[MQTT] Reintento %d/4...\n", _mqttFailCount);
+      IOT_LOGF("[MQTT] Reintento %d/4...\n", _mqttFailCount);
       delay(2000);
     }
   }
   
-  // Solo publicar sync si es primera configuración desde el portal
-  if (justConfigured) {
-    Serial.println("[IOT] Primera configuración, enviando sync...");
+  // Solo publicar sync si es primera configuración desde el portal (y el
+  // portal no lo envió ya al probar las credenciales)
+  if (justConfigured && !portalVerified()) {
+    IOT_LOG("[IOT] Primera configuración, enviando sync...");
     // Procesar varios loops antes del sync
     for (int i = 0; i < 10; i++) {
       mqttLoop();
@@ -89,24 +171,27 @@ void IoTConnectClass::begin(const char* apName, const char* appName) {
     }
     
     if (publishOkSync(g_cfg)) {
-      Serial.printf("[IOT] Sync enviado a %s/devices/sync\n", g_cfg.publicId);
+      IOT_LOGF("[IOT] Sync enviado a %s/devices/sync\n", g_cfg.publicId);
     } else {
-      Serial.println("[IOT] Error enviando sync");
+      IOT_LOG("[IOT] Error enviando sync");
     }
   }
   
   // Procesar paquetes MQTT y estabilizar conexión ANTES de notificar
-  Serial.println("[IOT] Estabilizando conexión...");
-  for (int i = 0; i < 20; i++) {
-    mqttLoop();
-    delay(50);
+  IOT_LOG("[IOT] Estabilizando conexión...");
+  {
+    IOT_TRACE("begin.stabilize");
+    for (int i = 0; i < 20; i++) {
+      mqttLoop();
+      delay(50);
+    }
   }
   
   // Verificar que sigue conectado después de estabilizar
   if (!isMqttConnected()) {
-    Serial.println("[IOT] Conexión perdida durante estabilización, reintentando...");
+    IOT_LOG("[IOT] Conexión perdida durante estabilización, reintentando...");
     if (!mqttConnect(g_cfg)) {
-      Serial.println("[IOT] Reconexión fallida, reiniciando...");
+      IOT_LOG("[IOT] Reconexión fallida, reiniciando...");
       ESP.restart();
     }
     // Estabilizar de nuevo
@@ -116,28 +201,169 @@ void IoTConnectClass::begin(const char* apName, const char* appName) {
     }
   }
   
-  Serial.printf("[IOT] %s conectado y estable!\n", _appName);
+  IOT_LOGF("[IOT] %s conectado y estable!\n", _appName);
   _normalOperation = true;
   _wasConnected = true;
   
   // Ahora sí notificar - la conexión está estable
   notifyConnectionChange(true);
+  startServices();
+  
+  if (_useNetworkTask) {
+    _netReady = true;
+    BaseType_t ok = xTaskCreatePinnedToCore(networkTaskEntry, "iotconnect_net", NET_TASK_STACK,
+                                            this, NET_TASK_PRIORITY, &_networkTask, _networkCore);
+    if (ok == pdPASS) {
+      IOT_LOGF("[IOT] Task de red iniciado en core %d\n", _networkCore);
+    } else {
+      IOT_LOG("[IOT] Error creando task de red, se usa loop()");
+      _networkTask = nullptr;
+    }
+  }
 }
 
+// Duración del último ciclo despierto (sobrevive al deep sleep)
+RTC_DATA_ATTR static uint32_t lastWakeToSleepMs = 0;
+
+bool IoTConnectClass::beginFastResume(const char* apName, const char* appName) {
+  _apName = apName;
+  _appName = appName;
+  
+  Serial.begin(115200);
+  IOT_LOGF("\n=== %s IoT Connect v1.0 (arranque rápido) ===\n", _appName);
+  
+  setPortalNames(_apName, _appName);
+  loadConfig(g_cfg);
+  
+  // Sin configuración previa o con credenciales nuevas: camino normal
+  bool sameCredentials = !_hasCredentials || memcmp(&_credentials, &g_cfg, sizeof(g_cfg)) == 0;
+  if (g_cfg.confirmed && sameCredentials) {
+    setMqttMessageCallback([](const char* topic, const uint8_t* payload, unsigned int length) {
+      IoTConnect.handleIncoming(topic, payload, length);
+    });
+    setMqttReadGate(canReadInbound);
+    
+    if (connectWifiFast(g_cfg)) {
+      mqttSetFastMode(true);
+      mqttBegin();
+      strlcpy(_servicesPublicId, g_cfg.publicId, sizeof(_servicesPublicId));
+      if (_otaEnabled) otaBegin(g_cfg.publicId);
+      if (_clockSyncMs) clockBegin(g_cfg.publicId, _clockSyncMs);
+      if (mqttConnect(g_cfg)) {
+        IOT_LOGF("[IOT] Conectado en %lu ms\n", millis());
+        _initialized = true;
+        _normalOperation = true;
+        _wasConnected = true;
+        _fastResume = true;
+        notifyConnectionChange(true);
+        startServices();
+        return true;
+      }
+      mqttSetFastMode(false);
+    }
+  }
+  
+  IOT_LOG("[IOT] Arranque rápido no disponible, conexión completa");
+  begin(apName, appName);
+  return false;
+}
+
+// Nada esperando en el Outbox ni en publishLatest
+static bool sendQueuesEmpty() {
+  for (uint8_t cls = 0; cls < OUTBOX_CLASSES; cls++) {
+    if (outboxDepth(cls) > 0) return false;
+  }
+  return latestPendingCount() == 0;
+}
+
+bool IoTConnectClass::readyToSleep() {
+  if (!sendQueuesEmpty()) return false;
+  if (_networkTask) {
+    // confirmDelivery() puede enviar un PINGREQ: lo pregunta el task de red y
+    // aquí solo se lee la respuesta, que vale si nada se envió después
+    if (!_deliveryChecked.exchange(false)) {
+      if (!_deliveryAsked.exchange(true)) {
+        ControlItem item;
+        item.type = ControlType::ConfirmDelivery;
+        item.qos = 0;
+        item.topic[0] = '\0';
+        if (!controlQueue.push(item)) _deliveryAsked = false;
+      }
+      return false;
+    }
+    if (!_deliveryConfirmed) return false;
+  } else if (!mqttDeliveryConfirmed()) {
+    return false;
+  }
+  shadowFlush();
+  
+  // millis() empieza de cero en cada despertar
+  lastWakeToSleepMs = millis();
+  return true;
+}
+
+bool IoTConnectClass::deliveryLost() { return mqttDeliveryLost(); }
+
+uint32_t IoTConnectClass::getWakeToSleepMs() { return lastWakeToSleepMs; }
+
 void IoTConnectClass::loop() {
   if (!_initialized) return;
   
+  // Con task de red, loop() solo entrega los eventos en el task de la app
+  if (_networkTask) {
+    telemetryService(isReady());
+    rpcSweep();
+    shadowService(isReady());
+    dispatchPending();
+    return;
+  }
+  
   if (isPortalActive()) {
     handlePortalLoop();
+    if (g_cfg.confirmed) leavePortal();
     delay(10);
   } else if (_normalOperation) {
     handleNormalOperation();
-    delay(100);
+    otaService();
+    // Cada mensaje espera a su propia conexión, no a la principal
+    if (isWifiConnected()) {
+      outboxService(OUTBOX_BURST);
+      latestSendPending();
+    }
+    if (isReady() && isMqttStable()) clockService();
+    telemetryService(isReady());
+    rpcSweep();
+    shadowService(isReady());
+    dispatchPending();
+    // Con un eco del reloj en vuelo, la respuesta se lee en la próxima vuelta
+    delay(_fastResume || clockWaiting() ? 1 : 100);
   }
 }
 
+void IoTConnectClass::runPortalUntilConfigured(bool clearCurrent) {
+#ifdef IOTCONNECT_NO_PORTAL
+  // Sin portal no hay forma de pedir otra configuración: reintentar desde cero
+  (void)clearCurrent;
+  IOT_LOG("[IOT] Sin portal y sin conexión válida, reiniciando en 10 s...");
+  delay(10000);
+  ESP.restart();
+#else
+  if (clearCurrent) {
+    clearConfig();
+    memset(&g_cfg, 0, sizeof(g_cfg));
+  }
+  IOT_TRACE("portal");
+  enterPortalMode();
+  while (!g_cfg.confirmed) {
+    handlePortalLoop();
+    delay(10);
+  }
+  stopPortal();
+#endif
+}
+
 void IoTConnectClass::enterPortalMode() {
-  Serial.printf("[IOT] Portal: %s en 192.168.4.1\n", _apName);
+  IOT_LOGF("[IOT] Portal: %s en 192.168.4.1\n", _apName);
   startPortal();
 }
 
@@ -145,9 +371,37 @@ void IoTConnectClass::handlePortalLoop() {
   portalLoop();
 }
 
+// Portal abierto en marcha (reset o fallos MQTT) con credenciales ya
+// verificadas: volver a la operación normal sin reiniciar
+void IoTConnectClass::leavePortal() {
+  IOT_LOG("[IOT] Configuración verificada, saliendo del portal");
+  stopPortal();
+  
+  // OTA, reloj, RPC, shadow, los handles y las suscripciones se armaron con
+  // el publicId anterior: se rehace todo arrancando de nuevo
+  if (_servicesPublicId[0] && strcmp(_servicesPublicId, g_cfg.publicId) != 0) {
+    IOT_LOG("[IOT] Cambió el publicId, reiniciando...");
+    delay(100);
+    ESP.restart();
+  }
+  
+  _mqttFailCount = 0;
+  _normalOperation = true;
+}
+
 void IoTConnectClass::handleNormalOperation() {
   ensureWifi();
   
+  uint8_t bssid[6];
+  int32_t channel;
+  if (_wasConnected && wifiRoamCheck(g_cfg, bssid, &channel)) roam(bssid, channel);
+  
+  // Sin WiFi la caída empieza ya, no cuando vuelva y falle MQTT
+  if (!isWifiConnected() && _wasConnected) {
+    _wasConnected = false;
+    notifyConnectionChange(false);
+  }
+  
   if (isWifiConnected()) {
     if (isMqttConnected()) {
       mqttLoop();
@@ -155,7 +409,8 @@ void IoTConnectClass::handleNormalOperation() {
       
       if (!_wasConnected) {
         // Estabilizar conexión BIEN antes de notificar
-        Serial.println("[IOT] Reconexión detectada, estabilizando...");
+        IOT_LOG("[IOT] Reconexión detectada, estabilizando...");
+        IOT_TRACE("reconnect.stabilize");
         for (int i = 0; i < 20; i++) {
           if (!isMqttConnected()) break;
           mqttLoop();
@@ -165,7 +420,7 @@ void IoTConnectClass::handleNormalOperation() {
         // Solo notificar si sigue conectado
         if (isMqttConnected()) {
           _wasConnected = true;
-          Serial.println("[IOT] Conexión estable, notificando...");
+          IOT_LOG("[IOT] Conexión estable, notificando...");
           notifyConnectionChange(true);
         }
       }
@@ -181,24 +436,193 @@ void IoTConnectClass::handleNormalOperation() {
         
         if (!mqttConnect(g_cfg)) {
           _mqttFailCount++;
+#ifndef IOTCONNECT_NO_PORTAL
           if (_mqttFailCount >= 4) {
-            Serial.println("[MQTT] 4 fallos, volviendo a portal");
+            IOT_LOG("[MQTT] 4 fallos, volviendo a portal");
             clearConfig();
             memset(&g_cfg, 0, sizeof(g_cfg));
             _normalOperation = false;
             startPortal();
           }
+#endif
         }
       }
     }
   }
 }
 
+void IoTConnectClass::roam(const uint8_t* bssid, int32_t channel) {
+  // Cierre limpio antes de soltar el AP: el Outbox deja de enviar (no hay
+  // conexión estable) y lo encolado no se descarta contra un socket muerto
+  IOT_LOG("[IOT] Cambiando de AP");
+  mqttDisconnect();
+  _stats.roams++;
+  wifiRoamTo(g_cfg, bssid, channel);
+  _lastMqttRetry = 0;  // Reconectar MQTT en cuanto vuelva la WiFi
+}
+
+void IoTConnectClass::networkTaskEntry(void* arg) {
+  IoTConnectClass* self = static_cast<IoTConnectClass*>(arg);
+  for (;;) {
+    self->networkTick();
+    vTaskDelay(pdMS_TO_TICKS(10));
+  }
+}
+
+void IoTConnectClass::networkTick() {
+  if (_resetRequested.exchange(false)) performReset();
+  
+  if (isPortalActive()) {
+    handlePortalLoop();
+    if (g_cfg.confirmed) leavePortal();
+  } else if (_normalOperation) {
+    handleNormalOperation();
+    
+    // Suscripciones pedidas por la app (el registro las envía al conectar)
+    ControlItem* item;
+    while ((item = controlQueue.front()) != nullptr) {
+      bool ok = false;
+      switch (item->type) {
+        case ControlType::Subscribe:   ok = mqttSubscribe(item->topic, item->qos); break;
+        case ControlType::Unsubscribe: ok = mqttUnsubscribe(item->topic); break;
+        case ControlType::PublishTrace:
+#ifdef IOTCONNECT_TRACE
+          ok = publishTraceNow(item->topic);
+#endif
+          break;
+        case ControlType::ConfirmDelivery:
+          _deliveryConfirmed = mqttDeliveryConfirmed();
+          _deliveryChecked = true;
+          _deliveryAsked = false;
+          ok = true;
+          break;
+      }
+      if (!ok) _droppedMessages++;
+      controlQueue.drop();
+    }
+    
+    otaService();
+    if (isWifiConnected()) {
+      // Lo que se envíe ahora deja sin valor la última confirmación
+      if (!sendQueuesEmpty()) _deliveryChecked = false;
+      outboxService(OUTBOX_BURST);
+      latestSendPending();
+    }
+    if (isMqttStable()) clockService();
+  }
+  
+  _netReady = _normalOperation && isWifiConnected() && isMqttConnected();
+}
+
+void IoTConnectClass::dispatchPending() {
+  // No reentrante: si un handler llama a loop() no se entrega nada más
+  if (_dispatching) return;
+  _dispatching = true;
+  
+  bool connected;
+  while (connectionEvents.pop(connected)) {
+    if (_connectionCallback) _connectionCallback(connected);
+  }
+  
+  // Solo lo que había al empezar, para no quedarse aquí bajo una ráfaga.
+  // Se entrega desde el hueco de la cola, que no se libera hasta drop():
+  // lo que llegue mientras tanto va a otros huecos
+  size_t pending = inboundQueue.size();
+  MqttMessage* msg;
+  while (pending-- > 0 && (msg = inboundQueue.front()) != nullptr) {
+    bool handled = rpcHandle(msg->topic, msg->payload) ||
+                   shadowHandle(msg->topic, msg->payload, msg->length) ||
+                   (_jsonCallback && dispatchJson(*msg));
+    if (!handled && _messageCallback) _messageCallback(msg->topic, msg->payload);
+    inboundQueue.drop();
+  }
+  
+  _dispatching = false;
+}
+
+// Interpreta el payload directamente desde el hueco de la cola. Como const
+// char* ArduinoJson no lo modifica: solo copia a jsonDoc las cadenas que deja
+// pasar el filtro y, si no se puede interpretar, el mensaje llega intacto a
+// onMessage
+bool IoTConnectClass::dispatchJson(const MqttMessage& msg) {
+  if (jsonTopic[0] && !topicMatches(jsonTopic, msg.topic)) return false;
+  const char* start = msg.payload;
+  while (isspace((unsigned char)*start)) start++;
+  if (*start != '{') return false;
+  
+  const char* text = msg.payload;
+  DeserializationError err = jsonFiltered
+    ? deserializeJson(jsonDoc, text, msg.length, DeserializationOption::Filter(jsonFilter))
+    : deserializeJson(jsonDoc, text, msg.length);
+  if (err) {
+    IOT_LOGF("[JSON] %s no interpretado (%s), va a onMessage\n", msg.topic, err.c_str());
+    return false;
+  }
+  _jsonCallback(msg.topic, jsonDoc.as<JsonObjectConst>());
+  return true;
+}
+
+bool IoTConnectClass::canReadInbound() {
+  if (IoTConnect._inboundPolicy != InboundPolicy::PauseReading) return true;
+  return inboundQueue.size() < inboundQueue.capacity();
+}
+
 void IoTConnectClass::notifyConnectionChange(bool connected) {
+  unsigned long now = millis();
+  if (!connected) {
+    _stats.disconnects++;
+    _downSince = now ? now : 1;
+  } else if (_downSince) {
+    uint32_t down = now - _downSince;
+    _stats.lastRecoveryMs = down;
+    if (down > _stats.maxRecoveryMs) _stats.maxRecoveryMs = down;
+    _stats.totalDownMs += down;
+    _downSince = 0;
+    IOT_LOGF("[IOT] Conexión recuperada en %lu ms\n", (unsigned long)down);
+  }
+  
+  if (_networkTask) {
+    if (!connectionEvents.push(connected)) _droppedMessages++;
+    return;
+  }
   if (_connectionCallback) _connectionCallback(connected);
 }
 
+void IoTConnectClass::handleIncoming(const char* topic, const uint8_t* payload, unsigned int length) {
+  // Los trozos de firmware se escriben desde el buffer de recepción, sin cola
+  if (otaHandle(topic, payload, length)) return;
+  if (clockHandle(topic, payload, length)) return;
+  clockReceive(payload, length);
+  
+  // El consumidor de la cola es el task de la app: solo se puede retirar
+  // el más antiguo desde aquí cuando ambos son el mismo task y no se está
+  // entregando (el hueco en uso es justo el más antiguo)
+  if (inboundQueue.size() >= inboundQueue.capacity() &&
+      _inboundPolicy == InboundPolicy::DropOldest && !_networkTask && !_dispatching) {
+    inboundQueue.drop();
+    _droppedMessages++;
+  }
+  
+  // Se copia una sola vez, del buffer de PubSubClient al hueco de la cola
+  MqttMessage* slot = inboundQueue.back();
+  if (!slot) {
+    _droppedMessages++;
+    IOT_LOGF("[IOT] Mensaje descartado (cola llena): %s\n", topic);
+    return;
+  }
+  if (!fillMqttMessage(*slot, topic, payload, length)) {
+    _droppedMessages++;
+    IOT_LOGF("[IOT] Mensaje descartado (demasiado grande): %s\n", topic);
+    return;
+  }
+  inboundQueue.commit();
+  
+  size_t depth = inboundQueue.size();
+  if (depth > _inboundPeak) _inboundPeak = depth;
+}
+
 bool IoTConnectClass::isReady() {
+  if (_networkTask) return _netReady;
   return _normalOperation && isWifiConnected() && isMqttConnected();
 }
 
@@ -206,21 +630,223 @@ bool IoTConnectClass::isConfigMode() {
   return isPortalActive();
 }
 
-bool IoTConnectClass::publish(const char* topic, const char* payload, bool retained) {
-  if (!isReady() || !isMqttStable()) return false;
-  return mqttPublish(topic, payload, retained);
+bool IoTConnectClass::publish(const char* topic, const char* payload, bool retained, MqttPriority priority) {
+  if (_networkTask ? !_netReady : (!isReady() || !isMqttStable())) {
+    _stats.rejectedPublishes++;
+    return false;
+  }
+  
+  // Encolar sin bloquear en la clase pedida; se envía en loop() o en el task de red
+  static MqttMessage msg;  // Solo se publica desde el task de la app
+  if (!fillMqttMessage(msg, topic, payload, retained)) return false;
+  clockStamp(msg);
+  if (!outboxPush(static_cast<uint8_t>(priority), msg)) {
+    _droppedMessages++;
+    return false;
+  }
+  return true;
+}
+
+bool IoTConnectClass::publishLatest(const char* topic, const char* payload, bool retained) {
+  // Siempre se guarda, aunque no haya conexión: se enviará al reconectar
+  return latestStore(topic, payload, retained);
+}
+
+TopicHandle IoTConnectClass::topic(const char* suffix) {
+  TopicHandle handle;
+  if (strlen(g_cfg.publicId) == 0) return handle;
+  
+  char full[MQTT_TOPIC_MAX];
+  int len = snprintf(full, sizeof(full), "%s/%s", g_cfg.publicId, suffix);
+  if (len < 0 || (size_t)len >= sizeof(full)) return handle;
+  
+  // Registrar dos veces el mismo topic devuelve el mismo handle
+  for (size_t i = 0; i < topicHandleCount; i++) {
+    if (strcmp(topicHandles[i], full) == 0) {
+      handle.index = i;
+      return handle;
+    }
+  }
+  if (topicHandleCount >= MQTT_TOPIC_HANDLES) {
+    IOT_LOGF("[IOT] Sin huecos para topics (%d)\n", (int)MQTT_TOPIC_HANDLES);
+    return handle;
+  }
+  memcpy(topicHandles[topicHandleCount], full, len + 1);
+  handle.index = topicHandleCount++;
+  return handle;
+}
+
+const char* IoTConnectClass::topicName(TopicHandle topic) {
+  if (!topic.valid() || (size_t)topic.index >= topicHandleCount) return nullptr;
+  return topicHandles[topic.index];
+}
+
+bool IoTConnectClass::publish(TopicHandle topic, const char* payload, bool retained, MqttPriority priority) {
+  const char* name = topicName(topic);
+  return name && publish(name, payload, retained, priority);
+}
+
+bool IoTConnectClass::publishLatest(TopicHandle topic, const char* payload, bool retained) {
+  const char* name = topicName(topic);
+  return name && publishLatest(name, payload, retained);
+}
+
+int IoTConnectClass::addTelemetry(const char* topic, uint32_t windowMs, uint16_t maxSamples,
+                                  TelemetryEncoding encoding, float resolution) {
+  return telemetryAddChannel(topic, windowMs, maxSamples, encoding, resolution);
+}
+
+bool IoTConnectClass::record(int channel, float value) {
+  return telemetryRecord(channel, value);
+}
+
+bool IoTConnectClass::subscribe(const char* topic, uint8_t qos) {
+  // El registro la envía en cuanto haya conexión, no hace falta isReady()
+  if (_networkTask) {
+    ControlItem item;
+    item.type = ControlType::Subscribe;
+    item.qos = qos;
+    if (strlcpy(item.topic, topic, sizeof(item.topic)) >= sizeof(item.topic)) return false;
+    return controlQueue.push(item);
+  }
+  return mqttSubscribe(topic, qos);
+}
+
+bool IoTConnectClass::unsubscribe(const char* topic) {
+  if (_networkTask) {
+    ControlItem item;
+    item.type = ControlType::Unsubscribe;
+    item.qos = 0;
+    if (strlcpy(item.topic, topic, sizeof(item.topic)) >= sizeof(item.topic)) return false;
+    return controlQueue.push(item);
+  }
+  return mqttUnsubscribe(topic);
+}
+
+void IoTConnectClass::setPriorityWeight(MqttPriority priority, uint8_t weight) {
+  outboxSetWeight(static_cast<uint8_t>(priority), weight);
+}
+
+void IoTConnectClass::setRateLimit(MqttPriority priority, float messagesPerSec, uint8_t burst) {
+  outboxSetRateLimit(static_cast<uint8_t>(priority), messagesPerSec, burst);
+}
+
+void IoTConnectClass::setPersistentSession(bool persistent) {
+  mqttSetPersistentSession(persistent);
+}
+
+// RPC y shadow necesitan publicId: se arrancan al entrar en operación
+// normal o al usarlos por primera vez después
+void IoTConnectClass::startServices() {
+  if (strlen(g_cfg.publicId) == 0) return;
+  auto subscribe = [](const char* topic, uint8_t qos) {
+    return IoTConnect.subscribe(topic, qos);
+  };
+  if (_rpcEnabled && !_rpcStarted) {
+    rpcBegin(g_cfg.publicId, subscribe);
+    _rpcStarted = true;
+  }
+  if (_shadowEnabled && !_shadowStarted) {
+    shadowBegin(g_cfg.publicId, subscribe);
+    _shadowStarted = true;
+  }
+}
+
+bool IoTConnectClass::onRpc(const char* method, RpcHandler handler) {
+  _rpcEnabled = true;
+  if (_normalOperation) startServices();
+  return rpcOn(method, handler);
+}
+
+bool IoTConnectClass::call(const char* method, const char* args, uint32_t timeoutMs, RpcCallback callback) {
+  _rpcEnabled = true;
+  if (_normalOperation) startServices();
+  return rpcCall(method, args, timeoutMs, callback);
+}
+
+bool IoTConnectClass::setState(const char* key, const char* value) {
+  _shadowEnabled = true;
+  if (_normalOperation) startServices();
+  return shadowSet(key, value);
+}
+
+const char* IoTConnectClass::getState(const char* key) {
+  return shadowGet(key);
+}
+
+const char* IoTConnectClass::getDesired(const char* key) {
+  return shadowGetDesired(key);
+}
+
+void IoTConnectClass::onDesired(ShadowCallback callback) {
+  _shadowEnabled = true;
+  if (_normalOperation) startServices();
+  shadowOnDesired(callback);
+}
+
+uint32_t IoTConnectClass::getStateVersion() {
+  return shadowVersion();
+}
+
+void IoTConnectClass::enableRoaming(int8_t thresholdDbm, uint8_t marginDb, uint32_t scanIntervalMs) {
+  wifiSetRoaming(thresholdDbm, marginDb, scanIntervalMs);
+}
+
+void IoTConnectClass::enableLatencyTracking(uint32_t syncIntervalMs) {
+  _clockSyncMs = syncIntervalMs ? syncIntervalMs : 1;
+}
+
+bool IoTConnectClass::isClockSynced() {
+  return clockSynced();
+}
+
+LatencyStats IoTConnectClass::getLatencyStats() {
+  return clockStats();
+}
+
+void IoTConnectClass::enableOta() {
+  _otaEnabled = true;
 }
 
-bool IoTConnectClass::subscribe(const char* topic) {
-  if (!isReady() || !isMqttStable()) return false;
-  return mqttSubscribe(topic);
+bool IoTConnectClass::isUpdating() {
+  return otaActive();
+}
+
+int IoTConnectClass::addConnection(const char* clientIdSuffix, uint16_t bufferSize) {
+  return mqttAddConnection(clientIdSuffix, bufferSize);
+}
+
+bool IoTConnectClass::routeTopic(const char* prefix, uint8_t connection) {
+  return mqttRoute(prefix, connection);
 }
 
 void IoTConnectClass::onMessage(MqttMessageCallback callback) {
   _messageCallback = callback;
-  setMqttMessageCallback([this](const char* topic, const char* payload) {
-    if (_messageCallback) _messageCallback(topic, payload);
-  });
+}
+
+bool IoTConnectClass::onJson(const char* topic, const char* filter, JsonMessageCallback callback) {
+  if (topic && strlcpy(jsonTopic, topic, sizeof(jsonTopic)) >= sizeof(jsonTopic)) {
+    IOT_LOGF("[JSON] Topic demasiado largo: %s\n", topic);
+    jsonTopic[0] = '\0';
+    return false;
+  }
+  if (!topic) jsonTopic[0] = '\0';
+  jsonFiltered = false;
+  if (filter) {
+    // El filtro se copia al documento: filter puede ser temporal
+    DeserializationError err = deserializeJson(jsonFilter, filter);
+    if (err) {
+      IOT_LOGF("[JSON] Filtro no válido: %s\n", err.c_str());
+      return false;
+    }
+    jsonFiltered = true;
+  }
+  _jsonCallback = callback;
+  return true;
+}
+
+void IoTConnectClass::setInboundPolicy(InboundPolicy policy) {
+  _inboundPolicy = policy;
 }
 
 void IoTConnectClass::onConnectionChange(ConnectionCallback callback) {
@@ -230,10 +856,75 @@ void IoTConnectClass::onConnectionChange(ConnectionCallback callback) {
 const char* IoTConnectClass::getClientId() { return g_cfg.clientId; }
 const char* IoTConnectClass::getPublicId() { return g_cfg.publicId; }
 
+uint32_t IoTConnectClass::getDroppedMessages() { return _droppedMessages; }
+size_t IoTConnectClass::getInboundQueueDepth() { return inboundQueue.size(); }
+size_t IoTConnectClass::getInboundQueuePeak() { return _inboundPeak; }
+uint32_t IoTConnectClass::getConflatedMessages() { return latestOverwrittenCount(); }
+uint32_t IoTConnectClass::getMergedWindows() { return telemetryMergedCount(); }
+
+#ifdef IOTCONNECT_TRACE
+size_t IoTConnectClass::dumpTrace(Print& out) {
+  return traceDump(out);
+}
+
+bool IoTConnectClass::publishTrace(const char* topic) {
+  if (_networkTask) {
+    ControlItem item;
+    item.type = ControlType::PublishTrace;
+    item.qos = 0;
+    if (strlcpy(item.topic, topic, sizeof(item.topic)) >= sizeof(item.topic)) return false;
+    return controlQueue.push(item);
+  }
+  return isReady() && publishTraceNow(topic);
+}
+#endif
+
+ConnectionStats IoTConnectClass::getConnectionStats() {
+  ConnectionStats stats = _stats;
+  stats.discardedPublishes = outboxDiscardedCount();
+  stats.lastMqttState = getMqttState();
+  stats.keepAliveMs = getMqttPingInterval();
+  stats.deadLinks = getMqttDeadLinks();
+  stats.unconfirmedDrops = getMqttUnconfirmedDrops();
+  return stats;
+}
+size_t IoTConnectClass::getOutboxDepth(MqttPriority priority) { return outboxDepth(static_cast<uint8_t>(priority)); }
+
 void IoTConnectClass::resetConfig() {
-  Serial.println("[IOT] Reset config");
+  // El reset toca WiFi y MQTT: con task de red se ejecuta en ese task
+  if (_networkTask) {
+    _resetRequested = true;
+    return;
+  }
+  performReset();
+}
+
+void IoTConnectClass::performReset() {
+  IOT_LOG("[IOT] Reset config");
   clearConfig();
   memset(&g_cfg, 0, sizeof(g_cfg));
   _normalOperation = false;
+#ifdef IOTCONNECT_NO_PORTAL
+  ESP.restart();
+#else
   startPortal();
+#endif
+}
+
+void IoTConnectClass::setCredentials(const char* ssid, const char* pass, const char* clientId,
+                                     const char* token, const char* publicId) {
+  memset(&_credentials, 0, sizeof(_credentials));
+  strlcpy(_credentials.ssid, ssid, sizeof(_credentials.ssid));
+  strlcpy(_credentials.pass, pass, sizeof(_credentials.pass));
+  strlcpy(_credentials.clientId, clientId, sizeof(_credentials.clientId));
+  strlcpy(_credentials.token, token, sizeof(_credentials.token));
+  strlcpy(_credentials.publicId, publicId, sizeof(_credentials.publicId));
+  _credentials.confirmed = true;
+  _hasCredentials = true;
+}
+
+#ifdef IOTCONNECT_TLS
+void IoTConnectClass::setCACert(const char* pem) {
+  mqttSetCACert(pem);
 }
+#endif
@@ -1,6 +1,16 @@
 #pragma once
 #include <Arduino.h>
 #include <functional>
+#include <atomic>
+#include <ArduinoJson.h>
+#include "Config.h"
+#include "Telemetry.h"
+#include "Rpc.h"
+#include "Shadow.h"
+#include "Clock.h"
+#ifdef IOTCONNECT_STATIC_ALLOC
+#include "StaticCallback.h"
+#endif
 
 // =============================================================================
 // IoTConnect - Librería para conexión IoT simplificada
@@ -22,13 +32,75 @@
 //       IoTConnect.publish("topic", "payload");
 //     }
 //   }
+//
+// Con -DIOTCONNECT_STATIC_ALLOC las colas, buffers y callbacks de la
+// librería tienen tamaño fijo: publicar, recibir y entregar no reservan
+// memoria. El core de Arduino sí la usa al reconectar (WiFiClient, WiFi),
+// al escanear redes y en el portal (String de WebServer).
+//
+// Los mensajes recibidos se copian a una cola de tamaño fijo y onMessage se
+// llama solo desde IoTConnect.loop(), nunca dentro de publish()/subscribe().
+//
+// Opcionalmente WiFi/MQTT/portal pueden ejecutarse en un task propio
+// (enableNetworkTask). En ese modo publish() y subscribe() solo encolan, y
+// los callbacks se entregan dentro de IoTConnect.loop(), en el task de la app.
 // =============================================================================
 
+#ifdef IOTCONNECT_STATIC_ALLOC
+// Modo sin heap tras begin(): callbacks que no reservan memoria
+// (funciones, lambdas sin captura o función + contexto)
+using MqttMessageCallback = StaticCallback<void(const char* topic, const char* payload)>;
+using JsonMessageCallback = StaticCallback<void(const char* topic, JsonObjectConst data)>;
+using ConnectionCallback = StaticCallback<void(bool connected)>;
+#else
 // Callback para mensajes MQTT recibidos
 using MqttMessageCallback = std::function<void(const char* topic, const char* payload)>;
 
+// Callback para mensajes JSON ya interpretados (ver onJson)
+using JsonMessageCallback = std::function<void(const char* topic, JsonObjectConst data)>;
+
 // Callback para eventos de conexión/desconexión
 using ConnectionCallback = std::function<void(bool connected)>;
+#endif
+
+// Clase de prioridad de una publicación. Los críticos salen en el siguiente
+// loop(); normal y bulk se reparten por peso (por defecto 4:1).
+enum class MqttPriority : uint8_t {
+  Critical,   // Alarmas, ACKs de comandos
+  Normal,
+  Bulk        // Telemetría masiva, reenvíos
+};
+
+// Topic registrado con IoTConnect.topic(): se formatea una sola vez
+static_assert(MQTT_TOPIC_HANDLES <= INT8_MAX, "IOTCONNECT_TOPIC_HANDLES no cabe en TopicHandle::index");
+struct TopicHandle {
+  int8_t index = -1;
+  bool valid() const { return index >= 0; }
+};
+
+// Recuperación de la conexión (IoTConnect.getConnectionStats). Con QoS 0 no
+// se sabe cuántos mensajes se perdieron en una caída: solo se cuenta lo que
+// la librería rechazó o descartó y las caídas con datos sin confirmar.
+struct ConnectionStats {
+  uint32_t disconnects;         // Pérdidas de conexión desde begin()
+  uint32_t lastRecoveryMs;      // Duración de la última caída
+  uint32_t maxRecoveryMs;       // Caída más larga
+  uint32_t totalDownMs;         // Suma de todas las caídas cerradas
+  uint32_t roams;               // Cambios de AP (enableRoaming)
+  uint32_t rejectedPublishes;   // publish() rechazados por no haber conexión
+  uint32_t discardedPublishes;  // Encolados que el broker no aceptó
+  int lastMqttState;            // < 0 red, 1..5 rechazo en el CONNACK
+  uint32_t keepAliveMs;         // Silencio antes de un PINGREQ (aprendido)
+  uint32_t deadLinks;           // Conexiones cerradas por falta de PINGRESP
+  uint32_t unconfirmedDrops;    // Caídas con publicaciones aún sin confirmar
+};
+
+// Qué hacer cuando llega un mensaje y la cola de recepción está llena
+enum class InboundPolicy : uint8_t {
+  DropNewest,    // Descartar el mensaje que acaba de llegar (por defecto)
+  DropOldest,    // Descartar el más antiguo sin entregar
+  PauseReading   // Dejar de leer del socket hasta que haya hueco
+};
 
 class IoTConnectClass {
 public:
@@ -37,6 +109,47 @@ public:
   // appName: nombre de la aplicación mostrado en el portal (ej: "MiApp")
   void begin(const char* apName, const char* appName);
   
+  // Arranque tras deep sleep: WiFi con canal/BSSID/IP de la vez anterior y
+  // MQTT sin esperas de estabilización. Si no es posible (primer arranque,
+  // red cambiada, broker caído) hace begin() completo y devuelve false.
+  // No usa el task de red. Con setPersistentSession(true) el broker guarda
+  // suscripciones y mensajes QoS 1 mientras el dispositivo duerme.
+  bool beginFastResume(const char* apName, const char* appName);
+  
+  // true cuando todo lo publicado ha llegado al broker y se puede dormir.
+  // Llamar a loop() mientras devuelva false.
+  bool readyToSleep();
+  
+  // Se cayó la conexión con publicaciones sin confirmar: se perdieron y
+  // readyToSleep() devuelve false hasta que se vuelvan a publicar
+  bool deliveryLost();
+  
+  // Tiempo despierto (ms desde el arranque hasta readyToSleep) del último ciclo
+  uint32_t getWakeToSleepMs();
+  
+  // Ejecutar WiFi/MQTT/portal en un task dedicado (llamar antes de begin)
+  // core: núcleo del ESP32 en el que se fija el task
+  // publish()/subscribe() deben llamarse siempre desde el mismo task (la app)
+  // No hace nada con IOTCONNECT_NO_OUTBOX
+  void enableNetworkTask(uint8_t core = 0);
+  
+  // Cambiar a un AP más fuerte del mismo SSID sin esperar a perder la
+  // conexión. Con la media de RSSI bajo thresholdDbm se escanea en segundo
+  // plano (cada scanIntervalMs como mucho) y se cambia si otro AP da al
+  // menos marginDb más. MQTT se cierra limpio antes del cambio: lo encolado
+  // se conserva y sale al reconectar.
+  void enableRoaming(int8_t thresholdDbm = -75, uint8_t marginDb = 8, uint32_t scanIntervalMs = 60000);
+  
+  // Credenciales fijadas por código (llamar antes de begin). Se guardan en
+  // NVS si cambian. Necesario con IOTCONNECT_NO_PORTAL.
+  void setCredentials(const char* ssid, const char* pass, const char* clientId,
+                      const char* token, const char* publicId);
+  
+#ifdef IOTCONNECT_TLS
+  // Certificado raíz (PEM) del broker. Sin él no se verifica el servidor.
+  void setCACert(const char* pem);
+#endif
+  
   // Loop principal - llamar en cada iteración
   void loop();
   
@@ -46,15 +159,101 @@ public:
   // ¿Está en modo configuración (portal cautivo)?
   bool isConfigMode();
   
-  // Publicar mensaje MQTT
-  bool publish(const char* topic, const char* payload, bool retained = false);
+  // Publicar mensaje MQTT. Se encola en la clase indicada y se envía desde
+  // loop(); devuelve false si no hay conexión o la cola está llena.
+  bool publish(const char* topic, const char* payload, bool retained = false,
+               MqttPriority priority = MqttPriority::Normal);
+  
+  // Publicar solo el último valor: si aún no se envió el anterior del mismo
+  // topic, se sobrescribe. Se envía desde loop() cuando hay conexión.
+  bool publishLatest(const char* topic, const char* payload, bool retained = false);
+  
+  // Registrar "<publicId>/<suffix>" una vez (después de begin) y publicar
+  // por handle, sin snprintf en cada envío. Handle inválido si no cabe.
+  TopicHandle topic(const char* suffix);
+  bool publish(TopicHandle topic, const char* payload, bool retained = false,
+               MqttPriority priority = MqttPriority::Normal);
+  bool publishLatest(TopicHandle topic, const char* payload, bool retained = false);
+  const char* topicName(TopicHandle topic);
   
-  // Suscribirse a topic
-  bool subscribe(const char* topic);
+  // Telemetría agregada: en vez de publicar cada muestra, publica un registro
+  // (n, min, max, media, último) por ventana de windowMs ms o maxSamples
+  // muestras. resolution es la unidad de los enteros en Delta. Devuelve el
+  // canal (-1 si no quedan). Los registros salen como Bulk.
+  int addTelemetry(const char* topic, uint32_t windowMs, uint16_t maxSamples = 0,
+                   TelemetryEncoding encoding = TelemetryEncoding::Json, float resolution = 0.01f);
+  bool record(int channel, float value);
   
-  // Callback cuando llega un mensaje MQTT
+  // Suscribirse a topic (qos 0 o 1). La suscripción se recuerda y se
+  // repite sola tras cada reconexión; no hace falta llamarla de nuevo.
+  bool subscribe(const char* topic, uint8_t qos = 0);
+  
+  // Cancelar suscripción y olvidarla
+  bool unsubscribe(const char* topic);
+  
+  // Peso de normal/bulk en el reparto (mensajes por ronda)
+  void setPriorityWeight(MqttPriority priority, uint8_t weight);
+  
+  // Límite de tasa por clase (token bucket). messagesPerSec = 0 lo quita.
+  // Con enableNetworkTask, configurar antes de begin().
+  void setRateLimit(MqttPriority priority, float messagesPerSec, uint8_t burst = 1);
+  
+  // Sesión persistente (cleanSession=false, llamar antes de begin): si el
+  // broker conserva la sesión no se re-suscribe tras reconectar
+  void setPersistentSession(bool persistent);
+  
+  // RPC sobre MQTT (protocolo en Rpc.h). onRpc atiende <publicId>/rpc/req/
+  // <method> y responde con el mismo id; call pide algo al servidor y llama
+  // a callback con la respuesta o con RPC_TIMEOUT. Ambos desde loop().
+  bool onRpc(const char* method, RpcHandler handler);
+  bool call(const char* method, const char* args, uint32_t timeoutMs, RpcCallback callback);
+  
+  // Estado del dispositivo (protocolo en Shadow.h). setState guarda en NVS y
+  // publica solo las claves que cambian, juntas en un mensaje por loop().
+  // onDesired avisa de los valores que pide la nube y no coinciden con los
+  // reportados: aplicarlos y confirmarlos con setState.
+  bool setState(const char* key, const char* value);
+  const char* getState(const char* key);
+  const char* getDesired(const char* key);
+  void onDesired(ShadowCallback callback);
+  uint32_t getStateVersion();
+  
+  // Latencia extremo a extremo (protocolo en Clock.h, antes de begin):
+  // sincroniza con la hora del servidor cada syncIntervalMs, marca los
+  // publish() con la hora de envío y mide la de los mensajes recibidos
+  // con marca (que llegan a onMessage sin ella)
+  void enableLatencyTracking(uint32_t syncIntervalMs = 300000);
+  bool isClockSynced();
+  LatencyStats getLatencyStats();
+  
+  // Actualización de firmware por MQTT en <publicId>/ota/... (antes de
+  // begin). Protocolo en Ota.h. Los trozos deben caber en el buffer MQTT.
+  void enableOta();
+  bool isUpdating();
+  
+  // Conexión adicional al broker (antes de begin). Devuelve su índice o -1.
+  // El clientId será <clientId><clientIdSuffix>. bufferSize = 0 usa el normal.
+  int addConnection(const char* clientIdSuffix, uint16_t bufferSize = 0);
+  
+  // Publicar/suscribir en topics que empiezan por prefix usa esa conexión
+  bool routeTopic(const char* prefix, uint8_t connection);
+  
+  // Callback cuando llega un mensaje MQTT (se entrega desde loop())
   void onMessage(MqttMessageCallback callback);
   
+  // Mensajes de topic (filtro MQTT con + y #; nullptr = todos) cuyo payload
+  // es un objeto JSON: se interpretan sin heap y solo con los campos de
+  // filter (p.ej. {"cmd":true,"value":true}; nullptr = todos). data solo es
+  // válido durante la llamada. Los demás mensajes, y los que no se pueden
+  // interpretar, siguen llegando a onMessage sin modificar. false si el
+  // topic o el filtro no son válidos.
+  bool onJson(const char* topic, const char* filter, JsonMessageCallback callback);
+  
+  // Política con la cola de recepción llena (ver InboundPolicy)
+  // DropOldest no es posible con enableNetworkTask, ni mientras se entrega un
+  // mensaje (lo que llega al publicar desde un handler): es DropNewest
+  void setInboundPolicy(InboundPolicy policy);
+  
   // Callback cuando cambia estado de conexión
   void onConnectionChange(ConnectionCallback callback);
   
@@ -64,9 +263,39 @@ public:
   
   // Forzar reset de configuración y volver al portal
   void resetConfig();
+  
+  // Mensajes descartados por colas llenas
+  uint32_t getDroppedMessages();
+  
+  // Mensajes recibidos pendientes de entregar y máximo alcanzado
+  size_t getInboundQueueDepth();
+  size_t getInboundQueuePeak();
+  
+  // Valores de publishLatest() sobrescritos antes de enviarse
+  uint32_t getConflatedMessages();
+  
+  // Ventanas de telemetría fundidas con otra por no poder publicarse
+  uint32_t getMergedWindows();
+  
+  // Publicaciones pendientes de enviar en una clase
+  size_t getOutboxDepth(MqttPriority priority);
+  
+  // Cuánto tardan en recuperarse las caídas y qué se pierde mientras tanto.
+  // Con enableNetworkTask los campos se leen sin bloqueo (pueden no ser de
+  // la misma instantánea).
+  ConnectionStats getConnectionStats();
+  
+#ifdef IOTCONNECT_TRACE
+  // Tramos de tiempo grabados (arranque, conexión, publicaciones) en formato
+  // trace_event de Chrome: por un Print (p. ej. Serial) o como un único
+  // mensaje MQTT, sin copiarlos a un buffer
+  size_t dumpTrace(Print& out);
+  bool publishTrace(const char* topic);
+#endif
 
 private:
   MqttMessageCallback _messageCallback = nullptr;
+  JsonMessageCallback _jsonCallback = nullptr;
   ConnectionCallback _connectionCallback = nullptr;
   const char* _apName = "IoT-Setup";
   const char* _appName = "IoT Connect";
@@ -75,11 +304,49 @@ private:
   unsigned long _lastMqttRetry = 0;
   bool _normalOperation = false;
   bool _initialized = false;
+  bool _fastResume = false;
+  bool _otaEnabled = false;
+  uint32_t _clockSyncMs = 0;   // 0 = sin latencia
+  bool _rpcEnabled = false;
+  bool _rpcStarted = false;
+  bool _shadowEnabled = false;
+  bool _shadowStarted = false;
+  char _servicesPublicId[IOTCONNECT_CONFIG_FIELD_MAX] = {};   // Con el que se armaron los topics
+  AppConfig _credentials = {};
+  bool _hasCredentials = false;
+  InboundPolicy _inboundPolicy = InboundPolicy::DropNewest;
+  bool _dispatching = false;
+  size_t _inboundPeak = 0;
+  ConnectionStats _stats = {};
+  unsigned long _downSince = 0;
   
+  // Task de red opcional
+  bool _useNetworkTask = false;
+  uint8_t _networkCore = 0;
+  TaskHandle_t _networkTask = nullptr;
+  std::atomic<bool> _netReady{false};
+  std::atomic<bool> _resetRequested{false};
+  std::atomic<uint32_t> _droppedMessages{0};
+  std::atomic<bool> _deliveryAsked{false};      // ConfirmDelivery en controlQueue
+  std::atomic<bool> _deliveryChecked{false};    // Respuesta sin leer en readyToSleep()
+  std::atomic<bool> _deliveryConfirmed{false};
+  
+  void runPortalUntilConfigured(bool clearCurrent);
   void enterPortalMode();
   void handlePortalLoop();
+  void leavePortal();
+  void startServices();
+  void roam(const uint8_t* bssid, int32_t channel);
   void handleNormalOperation();
   void notifyConnectionChange(bool connected);
+  void handleIncoming(const char* topic, const uint8_t* payload, unsigned int length);
+  void performReset();
+  
+  static void networkTaskEntry(void* arg);
+  void networkTick();
+  void dispatchPending();
+  bool dispatchJson(const MqttMessage& msg);
+  static bool canReadInbound();
 };
 
 // Instancia global singleton
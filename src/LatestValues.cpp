@@ -0,0 +1,97 @@
+#include "LatestValues.h"
+#include "Log.h"
+#include "Config.h"
+#include "MqttClient.h"
+#include <atomic>
+
+struct LatestSlot {
+  char topic[MQTT_TOPIC_MAX];
+  char payload[MQTT_LATEST_PAYLOAD_MAX + 1];
+  bool retained;
+  // Impar mientras se escribe; distinto de sentSeq si hay valor pendiente
+  std::atomic<uint32_t> seq{0};
+  uint32_t sentSeq = 0;  // Solo lo toca el que envía
+};
+
+static LatestSlot slots[MQTT_LATEST_SLOTS];
+static size_t nextSlot = 0;  // Round-robin del que envía
+static std::atomic<uint32_t> overwritten{0};
+
+static bool slotPending(const LatestSlot& slot, uint32_t seq) {
+  return seq != 0 && (seq & 1) == 0 && seq != slot.sentSeq;
+}
+
+bool latestStore(const char* topic, const char* payload, bool retained) {
+  size_t topicLen = strlen(topic);
+  size_t payloadLen = strlen(payload);
+  if (topicLen >= MQTT_TOPIC_MAX || payloadLen > MQTT_LATEST_PAYLOAD_MAX) {
+    IOT_LOGF("[MQTT] Latest: no cabe %s\n", topic);
+    return false;
+  }
+
+  LatestSlot* slot = nullptr;
+  for (auto& s : slots) {
+    uint32_t seq = s.seq.load(std::memory_order_relaxed);
+    if (seq == 0) {
+      if (!slot) slot = &s;  // Primer hueco libre, por si el topic es nuevo
+      continue;
+    }
+    if (strcmp(s.topic, topic) == 0) {
+      slot = &s;
+      if (slotPending(s, s.seq.load(std::memory_order_acquire))) overwritten++;
+      break;
+    }
+  }
+  if (!slot) {
+    IOT_LOGF("[MQTT] Latest: tabla llena (%d topics)\n", (int)MQTT_LATEST_SLOTS);
+    return false;
+  }
+
+  uint32_t seq = slot->seq.load(std::memory_order_relaxed);
+  slot->seq.store(seq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+  memcpy(slot->topic, topic, topicLen + 1);
+  memcpy(slot->payload, payload, payloadLen + 1);
+  slot->retained = retained;
+  slot->seq.store(seq + 2, std::memory_order_release);
+  return true;
+}
+
+size_t latestSendPending() {
+  static MqttMessage msg;  // Copia estable mientras se publica
+  size_t sent = 0;
+
+  for (size_t i = 0; i < MQTT_LATEST_SLOTS; i++) {
+    LatestSlot& slot = slots[(nextSlot + i) % MQTT_LATEST_SLOTS];
+    uint32_t seq = slot.seq.load(std::memory_order_acquire);
+    if (!slotPending(slot, seq)) continue;
+
+    // Copiar y comprobar que nadie escribió mientras tanto (si lo hizo, el
+    // valor nuevo sale en la siguiente vuelta)
+    strlcpy(msg.topic, slot.topic, sizeof(msg.topic));
+    strlcpy(msg.payload, slot.payload, sizeof(msg.payload));
+    msg.retained = slot.retained;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != seq) continue;
+
+    // Cada slot espera a su propia conexión, como en el Outbox
+    if (!isMqttStableAt(mqttRouteFor(msg.topic))) continue;
+    if (!mqttSend(msg.topic, msg.payload, msg.retained)) continue;
+    slot.sentSeq = seq;
+    sent++;
+  }
+  nextSlot = (nextSlot + 1) % MQTT_LATEST_SLOTS;
+  return sent;
+}
+
+size_t latestPendingCount() {
+  size_t count = 0;
+  for (auto& slot : slots) {
+    if (slotPending(slot, slot.seq.load(std::memory_order_acquire))) count++;
+  }
+  return count;
+}
+
+uint32_t latestOverwrittenCount() {
+  return overwritten;
+}
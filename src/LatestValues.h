@@ -0,0 +1,28 @@
+#pragma once
+#include <Arduino.h>
+
+// =============================================================================
+// LatestValues - Publicación conflacionada (solo el último valor por topic)
+// =============================================================================
+// Tabla fija de slots, uno por topic. Cada latestStore() sobrescribe en su
+// sitio el valor pendiente de ese topic; latestSendPending() envía todos los
+// pendientes cuando su conexión lo permite. Memoria y ancho de banda quedan
+// acotados sea cual sea la frecuencia de muestreo.
+//
+// Un único task escribe (latestStore) y otro puede enviar (latestSendPending):
+// cada slot se protege con un contador de secuencia, sin bloqueos.
+// =============================================================================
+
+// Guarda el último valor de topic. false si no caben o la tabla está llena.
+bool latestStore(const char* topic, const char* payload, bool retained = false);
+
+// Publica sin esperas todos los slots pendientes cuya conexión está estable,
+// empezando cada vez por uno distinto. Devuelve cuántos envió; los que fallan
+// siguen pendientes para la siguiente llamada.
+size_t latestSendPending();
+
+// Slots con un valor aún sin enviar
+size_t latestPendingCount();
+
+// Valores sobrescritos antes de llegar a enviarse
+uint32_t latestOverwrittenCount();
@@ -0,0 +1,12 @@
+#pragma once
+#include <Arduino.h>
+
+// Trazas por Serial. Con -DIOTCONNECT_NO_LOG desaparecen por completo
+// (ni código ni cadenas en flash).
+#ifdef IOTCONNECT_NO_LOG
+#define IOT_LOG(...)  do {} while (0)
+#define IOT_LOGF(...) do {} while (0)
+#else
+#define IOT_LOG(...)  Serial.println(__VA_ARGS__)
+#define IOT_LOGF(...) Serial.printf(__VA_ARGS__)
+#endif
@@ -1,193 +1,695 @@
 #include "MqttClient.h"
-#include <WiFi.h>
-#include <PubSubClient.h>
+#include "Log.h"
+#include "Trace.h"
+#include <algorithm>
 
-static WiFiClient wifiClient;
-static PubSubClient mqttClient(wifiClient);
-static int failCount = 0;
+// Estado compartido por todas las conexiones
 static InternalMqttCallback userCallback = nullptr;
+static MqttReadGate readGate = nullptr;
+static bool persistentSession = false;
+static bool fastMode = false;
+static const AppConfig* activeCfg = nullptr;  // Para reconectar las adicionales
+#ifdef IOTCONNECT_TLS
+static const char* caCert = nullptr;
+#endif
 
-// Flag para indicar que la conexión está estabilizada
-static bool connectionStable = false;
-static unsigned long connectionStableTime = 0;
+static MqttConnection connections[MQTT_MAX_CONNECTIONS];
+
+// Enrutado de topics por prefijo a conexiones adicionales
+struct MqttRoute {
+  char prefix[MQTT_TOPIC_MAX];
+  uint8_t connection;
+};
+
+static MqttRoute routes[MQTT_MAX_ROUTES];
+static size_t routeCount = 0;
+
+static constexpr unsigned long SUBACK_TIMEOUT_MS = 5000;
+static constexpr unsigned long SUBSCRIBE_SETTLE_MS = 600;
+static constexpr unsigned long SECONDARY_RETRY_MS = 5000;
+
+static uint8_t routeFor(const char* topic) {
+  // Gana el prefijo más largo
+  size_t best = 0;
+  uint8_t index = 0;
+  for (size_t i = 0; i < routeCount; i++) {
+    size_t len = strlen(routes[i].prefix);
+    if (len > best && strncmp(topic, routes[i].prefix, len) == 0) {
+      best = len;
+      index = routes[i].connection;
+    }
+  }
+  if (!connections[index].isConfigured()) index = 0;
+  return index;
+}
+
+static MqttConnection& connectionFor(const char* topic) {
+  return connections[routeFor(topic)];
+}
+
+static void encodeRemainingLength(uint8_t* out, size_t& pos, size_t length) {
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) digit |= 0x80;
+    out[pos++] = digit;
+  } while (length > 0);
+}
+
+// =============================================================================
+// MqttConnection
+// =============================================================================
+
+MqttConnection::MqttConnection() : _tap(_socket), _client(_tap) {
+  memset(_subs, 0, sizeof(_subs));
+}
+
+void MqttConnection::begin(uint8_t index, uint16_t bufferSize, uint16_t keepAlive, const char* clientIdSuffix) {
+  _index = index;
+  _configured = true;
+  strlcpy(_suffix, clientIdSuffix ? clientIdSuffix : "", sizeof(_suffix));
+  if (index > 0) snprintf(_tag, sizeof(_tag), "MQTT%u", index);
+
+  // Configurar buffer más grande para mensajes
+  _client.setBufferSize(bufferSize);
+#ifdef IOTCONNECT_TLS
+  if (caCert) {
+    _socket.setCACert(caCert);
+  } else {
+    IOT_LOGF("[%s] TLS sin certificado raíz: el servidor no se verifica\n", _tag);
+    _socket.setInsecure();
+  }
+#endif
+  _keepAlive = keepAlive;
+  if (_pingInterval == 0) {
+    _pingInterval = std::min(MQTT_PING_START_MS, (uint32_t)keepAlive * 750);
+  }
+  _client.setServer(MQTT_HOST, MQTT_PORT);
+  _client.setCallback([](char* topic, byte* payload, unsigned int length) {
+    IOT_LOGF("[MQTT] Recibido: %s (%u bytes)\n", topic, length);
+    if (userCallback) userCallback(topic, payload, length);
+  });
+  _tap.onPacket(onTapPacket, this);
+  IOT_LOGF("[%s] Configurado: %s:%d (buffer: %u, keepalive: %us)\n", _tag, MQTT_HOST, MQTT_PORT,
+           bufferSize, keepAlive);
+}
+
+// Procesa paquetes entrantes salvo que la cola de recepción pida pausa
+void MqttConnection::pump() {
+  if (readGate && !readGate()) return;
+  _client.loop();
+}
 
 // Espera activa para dar tiempo a que el broker consolide la conexión
 // y a que el stack TCP procese paquetes pendientes.
-static bool waitForStability(unsigned long minMs) {
-  if (!mqttClient.connected()) return false;
+bool MqttConnection::waitForStability(unsigned long minMs) {
+  if (!_client.connected()) return false;
   unsigned long now = millis();
-  unsigned long elapsed = now - connectionStableTime;
+  unsigned long elapsed = now - _stableTime;
   if (elapsed >= minMs) return true;
+  IOT_TRACE("mqtt.waitStability");
   unsigned long remaining = minMs - elapsed;
   unsigned long start = millis();
   while (millis() - start < remaining) {
-    if (!mqttClient.connected()) return false;
-    mqttClient.loop();
+    if (!_client.connected()) return false;
+    pump();
     delay(10);
   }
-  return mqttClient.connected();
+  return _client.connected();
 }
 
-static void internalCallback(char* topic, byte* payload, unsigned int length) {
-  char* payloadStr = new char[length + 1];
-  memcpy(payloadStr, payload, length);
-  payloadStr[length] = '\0';
-  
-  Serial.printf("[MQTT] Recibido: %s -> %s\n", topic, payloadStr);
-  if (userCallback) userCallback(topic, payloadStr);
-  delete[] payloadStr;
+void MqttConnection::onTapPacket(void* context, uint8_t type, const uint8_t* data, size_t length) {
+  static_cast<MqttConnection*>(context)->handleTapPacket(type, data, length);
 }
 
-void mqttBegin() {
-  // Configurar buffer más grande para mensajes
-  mqttClient.setBufferSize(1024);
-  // Keepalive más largo para conexiones lentas
-  mqttClient.setKeepAlive(60);
-  mqttClient.setServer(MQTT_HOST, MQTT_PORT);
-  mqttClient.setCallback(internalCallback);
-  Serial.printf("[MQTT] Configurado: %s:%d (buffer: 1024, keepalive: 60s)\n", MQTT_HOST, MQTT_PORT);
+// Paquetes que PubSubClient no expone (vistos a través de _tap)
+void MqttConnection::handleTapPacket(uint8_t type, const uint8_t* data, size_t length) {
+  if (type == 2 && length >= 2) {
+    // CONNACK: bit 0 del primer byte = session present
+    _sessionPresent = (data[0] & 0x01) != 0;
+    return;
+  }
+
+  if (type == 13) {
+    // PINGRESP: todo lo enviado antes de su PINGREQ ya está en el broker
+    if (_pingsAnswered < _pingsSent) _pingsAnswered++;
+    if (!_deliveryLost && _pingsAnswered > _deliveryMark) _delivered = true;
+    if (_pingsAnswered == _pingsSent) {
+      _pingDeadline = 0;
+      if (_probing) _probeFailed = false;
+      _probing = false;
+      if (_pingIdleMs) learnInterval(true, _pingIdleMs);
+      _pingIdleMs = 0;
+    }
+    return;
+  }
+
+  if (type == 9 && length >= 2) {
+    // SUBACK: packet id + un código de retorno por filtro, en orden
+    uint16_t packetId = (data[0] << 8) | data[1];
+    size_t code = 2;
+    for (auto& sub : _subs) {
+      if (sub.state != SubState::Sent || sub.packetId != packetId) continue;
+      if (code >= length) break;  // Más filtros que bytes capturados
+      if (data[code++] == 0x80) {
+        sub.state = SubState::Rejected;
+        IOT_LOGF("[%s] Sub rechazada: %s\n", _tag, sub.filter);
+      } else {
+        sub.state = SubState::Active;
+      }
+    }
+  }
 }
 
-bool mqttConnect(const AppConfig& cfg) {
-  if (mqttClient.connected()) return true;
-  
-  connectionStable = false;
-  
+MqttConnection::Subscription* MqttConnection::findSubscription(const char* filter) {
+  for (auto& sub : _subs) {
+    if (sub.state != SubState::Free && strcmp(sub.filter, filter) == 0) return &sub;
+  }
+  return nullptr;
+}
+
+// Envía todas las suscripciones pendientes agrupando tantos filtros por
+// SUBSCRIBE como quepan en el buffer. No espera al SUBACK.
+void MqttConnection::flushSubscriptions() {
+  if (!_client.connected() || !_stable) return;
+  if (!fastMode && millis() - _stableTime < SUBSCRIBE_SETTLE_MS) return;
+
+  unsigned long now = millis();
+  for (auto& sub : _subs) {
+    if (sub.state == SubState::Sent && now - sub.sentAt > SUBACK_TIMEOUT_MS) {
+      IOT_LOGF("[%s] Sin SUBACK, reintentando: %s\n", _tag, sub.filter);
+      sub.state = SubState::Pending;
+    }
+  }
+
+  // Cabecera fija (1 + hasta 4) + packet id (2) + filtros. Compartido: todas
+  // las conexiones se atienden desde el mismo task.
+  static uint8_t packet[MQTT_BUFFER_SIZE];
+  static constexpr size_t HEADER_RESERVE = 5;
+
+  while (true) {
+    uint16_t packetId = _nextSubPacketId++;
+    if (_nextSubPacketId == 0) _nextSubPacketId = 0xC000;
+
+    size_t pos = HEADER_RESERVE;
+    packet[pos++] = packetId >> 8;
+    packet[pos++] = packetId & 0xFF;
+
+    int count = 0;
+    for (auto& sub : _subs) {
+      if (sub.state != SubState::Pending) continue;
+      // SUBACK solo captura un número limitado de códigos de retorno
+      if (count >= (int)MqttTapClient::CAPTURE_SIZE - 2) break;
+      size_t len = strlen(sub.filter);
+      if (pos + 2 + len + 1 > sizeof(packet)) break;
+      packet[pos++] = len >> 8;
+      packet[pos++] = len & 0xFF;
+      memcpy(packet + pos, sub.filter, len);
+      pos += len;
+      packet[pos++] = sub.qos;
+      sub.state = SubState::Sent;
+      sub.packetId = packetId;
+      sub.sentAt = now;
+      count++;
+    }
+    if (count == 0) return;
+
+    // Colocar la cabecera fija justo antes del cuerpo
+    uint8_t header[HEADER_RESERVE];
+    size_t headerLen = 0;
+    header[headerLen++] = 0x82;  // SUBSCRIBE, QoS 1 obligatorio
+    encodeRemainingLength(header, headerLen, pos - HEADER_RESERVE);
+    size_t start = HEADER_RESERVE - headerLen;
+    memcpy(packet + start, header, headerLen);
+
+    size_t total = pos - start;
+    if (_client.write(packet + start, total) != total) {
+      IOT_LOGF("[%s] Error enviando SUBSCRIBE\n", _tag);
+      for (auto& sub : _subs) {
+        if (sub.state == SubState::Sent && sub.packetId == packetId) sub.state = SubState::Pending;
+      }
+      return;
+    }
+    IOT_LOGF("[%s] SUBSCRIBE enviado: %d filtros (%u bytes)\n", _tag, count, (unsigned)total);
+  }
+}
+
+bool MqttConnection::connect(const AppConfig& cfg) {
+  if (_client.connected()) return true;
+
+  _stable = false;
+  _lastAttempt = millis();
+
   if (strlen(cfg.clientId) == 0 || strlen(cfg.token) == 0) {
-    Serial.println("[MQTT] Error: clientId o token vacíos");
+    IOT_LOGF("[%s] Error: clientId o token vacíos\n", _tag);
     return false;
   }
-  
-  Serial.printf("[MQTT] Conectando como %s\n", cfg.clientId);
-  
-  if (mqttClient.connect(cfg.clientId, cfg.clientId, cfg.token)) {
-    Serial.println("[MQTT] Conectado!");
-    failCount = 0;
-    
+
+  snprintf(_clientId, sizeof(_clientId), "%s%s", cfg.clientId, _suffix);
+  IOT_LOGF("[%s] Conectando como %s\n", _tag, _clientId);
+
+  _sessionPresent = false;
+  // Un PINGRESP de la sesión nueva no dice nada de lo escrito en la anterior
+  if (!_delivered && !_deliveryLost) {
+    _deliveryLost = true;
+    _unconfirmedDrops++;
+    IOT_LOGF("[%s] Lo publicado antes de la caída no se confirmó\n", _tag);
+  }
+  _pingsSent = _pingsAnswered = _deliveryMark = 0;
+  _pingDeadline = 0;
+  _pingIdleMs = 0;
+  _probing = false;
+  _unansweredSince = 0;
+  _seenRead = _seenWritten = 0;
+  _lastIn = _lastOut = millis();
+  _client.setKeepAlive(_keepAlive);  // El que va en el CONNECT
+  bool accepted;
+  {
+    // DNS + TCP (+ TLS) + CONNECT/CONNACK, todo dentro de PubSubClient
+    IOT_TRACE("mqtt.connect");
+    accepted = _client.connect(_clientId, cfg.clientId, cfg.token, nullptr, 0, false, nullptr,
+                               !persistentSession);
+  }
+  if (accepted) {
+    IOT_LOGF("[%s] Conectado!\n", _tag);
+    _failCount = 0;
+    // A partir de aquí los PINGREQ los envía serviceKeepAlive()
+    _client.setKeepAlive(UINT16_MAX);
+
+    // Si el broker conservó la sesión, sus suscripciones siguen vigentes
+    bool keepSubs = persistentSession && _sessionPresent;
+    for (auto& sub : _subs) {
+      if (sub.state == SubState::Free) continue;
+      if (keepSubs && sub.state == SubState::Active) continue;
+      sub.state = SubState::Pending;
+    }
+    if (keepSubs) IOT_LOGF("[%s] Sesión conservada por el broker, sin re-suscribir\n", _tag);
+
     // Marcar tiempo de conexión para estabilización
-    connectionStableTime = millis();
-    
+    _stableTime = millis();
+
     // Procesar varios loops para estabilizar la conexión
-    for (int i = 0; i < 10; i++) {
-      mqttClient.loop();
-      delay(50);
+    if (!fastMode) {
+      IOT_TRACE("mqtt.settle");
+      for (int i = 0; i < 10; i++) {
+        pump();
+        delay(50);
+      }
     }
-    
-    connectionStable = true;
+
+    _stable = true;
     return true;
   }
-  
-  failCount++;
-  Serial.printf("[MQTT] Error: %d (fallos: %d)\n", mqttClient.state(), failCount);
+
+  _failCount++;
+  IOT_LOGF("[%s] Error: %d (fallos: %d)\n", _tag, _client.state(), _failCount);
   return false;
 }
 
-void mqttLoop() {
-  if (mqttClient.connected()) {
-    mqttClient.loop();
+void MqttConnection::loop() {
+  if (_client.connected()) {
+    pump();
+    flushSubscriptions();
+    serviceKeepAlive();
   }
 }
 
-void mqttDisconnect() {
-  connectionStable = false;
-  if (mqttClient.connected()) {
-    mqttClient.disconnect();
-    Serial.println("[MQTT] Desconectado");
+// PINGREQ solo cuando el tráfico no basta: en silencio (para el broker y
+// para el NAT) o cuando se envía y no llega nada que demuestre que el
+// enlace sigue vivo
+void MqttConnection::serviceKeepAlive() {
+  unsigned long now = millis();
+  // Cualquier byte en un sentido u otro cuenta como tráfico
+  if (_tap.bytesRead() != _seenRead) {
+    _seenRead = _tap.bytesRead();
+    _lastIn = now;
+    _unansweredSince = 0;
+  }
+  if (_tap.bytesWritten() != _seenWritten) {
+    _seenWritten = _tap.bytesWritten();
+    _lastOut = now;
+    if (!_unansweredSince) _unansweredSince = now;
+  }
+
+  // Con la lectura en pausa el PINGRESP no se puede ver: no es una caída
+  if (readGate && !readGate()) {
+    if (_pingDeadline) _pingDeadline = now + MQTT_PING_TIMEOUT_MS;
+    return;
+  }
+
+  if (_pingDeadline) {
+    if ((long)(now - _pingDeadline) < 0) return;
+    IOT_LOGF("[%s] Sin PINGRESP en %lu ms, conexión perdida\n", _tag,
+             (unsigned long)MQTT_PING_TIMEOUT_MS);
+    if (_pingIdleMs) learnInterval(false, _pingIdleMs);
+    if (_probing) _probeFailed = true;   // Tras reconectar se sondea sin esperar
+    _probing = false;
+    _pingDeadline = 0;
+    _pingIdleMs = 0;
+    _deadLinks++;
+    _stable = false;
+    _socket.stop();  // PubSubClient lo ve como conexión perdida
+    return;
+  }
+
+  uint32_t idleIn = now - _lastIn;
+  uint32_t idleOut = now - _lastOut;
+  uint32_t idle = std::min(idleIn, idleOut);
+  // Publicando sin parar siempre hay algo sin respuesta: un sondeo por
+  // intervalo basta, salvo que el último fallara
+  bool probeDue = _unansweredSince && now - _unansweredSince >= MQTT_PROBE_DELAY_MS &&
+                  (_probeFailed || !_lastProbe || now - _lastProbe >= _pingInterval);
+  if (idle >= _pingInterval) {
+    sendPing(idle);  // Silencio: de su respuesta se aprende el intervalo
+  } else if (idleOut >= (uint32_t)_keepAlive * 750) {
+    sendPing(0);     // El broker necesita algo nuestro
+  } else if (probeDue && sendPing(0)) {
+    _probing = true;
+    _lastProbe = now;
   }
 }
 
-bool publishOkSync(const AppConfig& cfg) {
-  if (!mqttClient.connected() || strlen(cfg.publicId) == 0) return false;
-  
+bool MqttConnection::sendPing(uint32_t idleMs) {
+  static const uint8_t pingreq[2] = {0xC0, 0x00};
+  if (_client.write(pingreq, sizeof(pingreq)) != sizeof(pingreq)) return false;
+  _pingsSent++;
+  if (!_pingDeadline) _pingDeadline = (millis() + MQTT_PING_TIMEOUT_MS) | 1;
+  _pingIdleMs = idleMs;
+  return true;
+}
+
+// Tiempo de expiración del NAT: se alarga el intervalo mientras haya
+// respuesta y se recorta por debajo del primer silencio que la pierde
+void MqttConnection::learnInterval(bool answered, uint32_t idleMs) {
+  uint32_t maxMs = (uint32_t)_keepAlive * 750;
+  if (answered) {
+    if (idleMs > _pingSafe) _pingSafe = idleMs;
+    uint32_t limit = _pingFailed > MQTT_PING_STEP_MS ? _pingFailed - MQTT_PING_STEP_MS : maxMs;
+    uint32_t next = std::min(_pingInterval + MQTT_PING_STEP_MS, std::min(limit, maxMs));
+    if (next > _pingInterval) _pingInterval = next;
+    return;
+  }
+  if (!_pingFailed || idleMs < _pingFailed) _pingFailed = idleMs;
+  _pingInterval = std::max(MQTT_PING_MIN_MS, std::min(_pingSafe ? _pingSafe : idleMs, idleMs * 3 / 4));
+  IOT_LOGF("[%s] Keepalive: PINGREQ cada %lu s\n", _tag, (unsigned long)(_pingInterval / 1000));
+}
+
+void MqttConnection::disconnect() {
+  _stable = false;
+  if (_client.connected()) {
+    _client.disconnect();
+    IOT_LOGF("[%s] Desconectado\n", _tag);
+  }
+}
+
+bool MqttConnection::publishOkSync(const AppConfig& cfg) {
+  if (!_client.connected() || strlen(cfg.publicId) == 0) return false;
+  IOT_TRACE("mqtt.sync");
+
   // Asegurar estabilidad antes de publicar sync
   for (int i = 0; i < 5; i++) {
-    mqttClient.loop();
+    pump();
     delay(20);
   }
-  
+
   char topic[128];
   snprintf(topic, sizeof(topic), "%s/devices/sync", cfg.publicId);
-  bool result = mqttClient.publish(topic, "ok");
-  mqttClient.loop();
+  bool result = _client.publish(topic, "ok");
+  pump();
   return result;
 }
 
-bool isMqttConnected() { return mqttClient.connected(); }
-bool isMqttStable() { return connectionStable && mqttClient.connected(); }
-int getMqttFailCount() { return failCount; }
-
-bool mqttPublish(const char* topic, const char* payload, bool retained) {
-  if (!mqttClient.connected()) {
-    Serial.println("[MQTT] Pub fallido: no conectado");
+bool MqttConnection::publish(const char* topic, const char* payload, bool retained) {
+  if (!_client.connected()) {
+    IOT_LOGF("[%s] Pub fallido: no conectado\n", _tag);
     return false;
   }
+  IOT_TRACE("mqtt.publish");
 
   // Asegurar que han pasado al menos 800ms desde la conexión
-  if (!waitForStability(800)) {
-    Serial.println("[MQTT] Pub fallido: conexión inestable");
+  if (!fastMode && !waitForStability(800)) {
+    IOT_LOGF("[%s] Pub fallido: conexión inestable\n", _tag);
     return false;
   }
-  
+
   // Procesar paquetes pendientes antes de publicar
-  for (int i = 0; i < 3; i++) {
-    mqttClient.loop();
+  for (int i = 0; i < 3 && !fastMode; i++) {
+    pump();
     delay(10);
   }
-  
+
   // Verificar conexión después de procesar
-  if (!mqttClient.connected()) {
-    Serial.println("[MQTT] Pub fallido: desconexión durante preparación");
+  if (!_client.connected()) {
+    IOT_LOGF("[%s] Pub fallido: desconexión durante preparación\n", _tag);
     return false;
   }
-  
-  bool result = mqttClient.publish(topic, payload, retained);
-  if (result) {
-    Serial.printf("[MQTT] Pub OK: %s\n", topic);
-    // Procesar ACK
-    for (int i = 0; i < 3; i++) {
-      mqttClient.loop();
-      delay(10);
-    }
-  } else {
-    Serial.printf("[MQTT] Pub FAIL: %s\n", topic);
+
+  bool result = send(topic, payload, retained);
+  // Procesar ACK
+  for (int i = 0; i < 3 && result && !fastMode; i++) {
+    pump();
+    delay(10);
   }
   return result;
 }
 
-bool mqttSubscribe(const char* topic) {
-  if (!mqttClient.connected()) {
-    Serial.println("[MQTT] Sub fallido: no conectado");
+bool MqttConnection::send(const char* topic, const char* payload, bool retained) {
+  if (!_client.connected()) return false;
+  IOT_TRACE("mqtt.send");
+  if (!_client.publish(topic, payload, retained)) {
+    IOT_LOGF("[%s] Pub FAIL: %s\n", _tag, topic);
     return false;
   }
+  IOT_LOGF("[%s] Pub OK: %s\n", _tag, topic);
+  _delivered = false;
+  _deliveryLost = false;
+  _deliveryMark = _pingsSent;
+  return true;
+}
+
+bool MqttConnection::publishStream(const char* topic, size_t length, size_t (*writer)(Print& out)) {
+  if (!_client.connected() || !_client.beginPublish(topic, length, false)) return false;
+  writer(_client);
+  if (_client.endPublish() != 1) return false;
+  _delivered = false;
+  _deliveryLost = false;
+  _deliveryMark = _pingsSent;
+  return true;
+}
+
+bool MqttConnection::confirmDelivery() {
+  if (_delivered) return true;
+  if (_deliveryLost) return false;  // Solo se arregla volviendo a publicar
+  // Hace falta un PINGREQ posterior a la última publicación
+  if (_pingsSent == _deliveryMark && _client.connected()) sendPing(0);
+  return false;
+}
 
-  // Asegurar un pequeño margen de estabilidad tras conectar
-  if (!waitForStability(600)) {
-    Serial.println("[MQTT] Sub fallido: conexión inestable");
+bool MqttConnection::subscribe(const char* topic, uint8_t qos) {
+  if (strlen(topic) >= MQTT_TOPIC_MAX || qos > 1) {
+    IOT_LOGF("[%s] Sub inválida: %s\n", _tag, topic);
     return false;
   }
-  
-  // Procesar paquetes antes de suscribirse
-  mqttClient.loop();
-  delay(20);
-  
-  bool result = mqttClient.subscribe(topic);
-  if (result) {
-    Serial.printf("[MQTT] Sub OK: %s\n", topic);
-    // Espera corta para captar SUBACK sin penalizar con timeouts largos
-    for (int i = 0; i < 10; i++) {
-      if (!mqttClient.connected()) {
-        Serial.println("[MQTT] Sub: desconexión durante espera");
-        return false;
-      }
-      mqttClient.loop();
-      delay(15);
+
+  Subscription* sub = findSubscription(topic);
+  if (sub && sub->qos == qos && sub->state != SubState::Rejected) return true;
+
+  if (!sub) {
+    for (auto& slot : _subs) {
+      if (slot.state == SubState::Free) { sub = &slot; break; }
     }
-  } else {
-    Serial.printf("[MQTT] Sub FAIL: %s\n", topic);
+    if (!sub) {
+      IOT_LOGF("[%s] Sub fallido: registro lleno (%d)\n", _tag, (int)MQTT_MAX_SUBSCRIPTIONS);
+      return false;
+    }
+    strlcpy(sub->filter, topic, sizeof(sub->filter));
   }
-  return result;
+
+  // Se envía ahora si la conexión lo permite, si no en el próximo loop()
+  sub->qos = qos;
+  sub->state = SubState::Pending;
+  IOT_LOGF("[%s] Sub registrada: %s (QoS %d)\n", _tag, topic, qos);
+  flushSubscriptions();
+  return true;
+}
+
+bool MqttConnection::unsubscribe(const char* topic) {
+  Subscription* sub = findSubscription(topic);
+  if (sub) sub->state = SubState::Free;
+  if (!_client.connected()) return sub != nullptr;
+  return _client.unsubscribe(topic);
+}
+
+int MqttConnection::activeSubscriptions() const {
+  int count = 0;
+  for (auto& sub : _subs) {
+    if (sub.state == SubState::Active) count++;
+  }
+  return count;
+}
+
+int MqttConnection::pendingSubscriptions() const {
+  int count = 0;
+  for (auto& sub : _subs) {
+    if (sub.state == SubState::Pending || sub.state == SubState::Sent) count++;
+  }
+  return count;
+}
+
+// =============================================================================
+// Funciones del cliente MQTT
+// =============================================================================
+
+void mqttBegin() {
+  connections[0].begin(0, MQTT_BUFFER_SIZE, MQTT_KEEPALIVE, "");
+}
+
+bool mqttConnect(const AppConfig& cfg) {
+  activeCfg = &cfg;
+  return connections[0].connect(cfg);
+}
+
+void mqttLoop() {
+  connections[0].loop();
+
+  // Las adicionales se reconectan solas mientras la principal está arriba
+  bool primaryUp = connections[0].connected();
+  for (size_t i = 1; i < MQTT_MAX_CONNECTIONS; i++) {
+    MqttConnection& conn = connections[i];
+    if (!conn.isConfigured()) continue;
+    if (conn.connected()) {
+      conn.loop();
+    } else if (primaryUp && activeCfg && millis() - conn.lastAttempt() > SECONDARY_RETRY_MS) {
+      conn.connect(*activeCfg);
+    }
+  }
+}
+
+void mqttDisconnect() {
+  for (auto& conn : connections) {
+    if (conn.isConfigured()) conn.disconnect();
+  }
+}
+
+bool publishOkSync(const AppConfig& cfg) {
+  return connections[0].publishOkSync(cfg);
+}
+
+bool isMqttConnected() { return connections[0].connected(); }
+bool isMqttStable() { return connections[0].stable(); }
+int getMqttFailCount() { return connections[0].failCount(); }
+uint32_t getMqttPingInterval() { return connections[0].pingInterval(); }
+uint32_t getMqttDeadLinks() { return connections[0].deadLinks(); }
+uint32_t getMqttUnconfirmedDrops() { return connections[0].unconfirmedDrops(); }
+int getMqttState() { return connections[0].state(); }
+bool isMqttConnectedFor(const char* topic) { return connectionFor(topic).connected(); }
+uint8_t mqttRouteFor(const char* topic) { return routeFor(topic); }
+bool isMqttStableAt(uint8_t index) { return index < MQTT_MAX_CONNECTIONS && connections[index].stable(); }
+
+bool mqttPublish(const char* topic, const char* payload, bool retained) {
+  return connectionFor(topic).publish(topic, payload, retained);
+}
+
+bool mqttSubscribe(const char* topic, uint8_t qos) {
+  return connectionFor(topic).subscribe(topic, qos);
+}
+
+bool mqttUnsubscribe(const char* topic) {
+  return connectionFor(topic).unsubscribe(topic);
+}
+
+void mqttLoopFor(const char* topic) {
+  MqttConnection& conn = connectionFor(topic);
+  if (conn.connected()) conn.loop();
+}
+
+bool mqttSend(const char* topic, const char* payload, bool retained) {
+  return connectionFor(topic).send(topic, payload, retained);
+}
+
+bool mqttPublishStream(const char* topic, size_t length, size_t (*writer)(Print& out)) {
+  return connectionFor(topic).publishStream(topic, length, writer);
+}
+
+int mqttAddConnection(const char* clientIdSuffix, uint16_t bufferSize, uint16_t keepAlive) {
+  for (size_t i = 1; i < MQTT_MAX_CONNECTIONS; i++) {
+    if (connections[i].isConfigured()) continue;
+    connections[i].begin(i, bufferSize ? bufferSize : MQTT_BUFFER_SIZE, keepAlive, clientIdSuffix);
+    return i;
+  }
+  IOT_LOGF("[MQTT] No quedan conexiones libres (%d)\n", (int)MQTT_MAX_CONNECTIONS);
+  return -1;
+}
+
+bool mqttRoute(const char* prefix, uint8_t connection) {
+  if (connection >= MQTT_MAX_CONNECTIONS || routeCount >= MQTT_MAX_ROUTES) return false;
+  if (strlcpy(routes[routeCount].prefix, prefix, MQTT_TOPIC_MAX) >= MQTT_TOPIC_MAX) return false;
+  routes[routeCount].connection = connection;
+  routeCount++;
+  return true;
+}
+
+#ifdef IOTCONNECT_TLS
+void mqttSetCACert(const char* pem) {
+  caCert = pem;
+}
+#endif
+
+void mqttSetFastMode(bool fast) {
+  fastMode = fast;
+}
+
+bool mqttDeliveryConfirmed() {
+  bool confirmed = true;
+  for (auto& conn : connections) {
+    if (conn.isConfigured() && !conn.confirmDelivery()) confirmed = false;
+  }
+  return confirmed;
+}
+
+bool mqttDeliveryLost() {
+  for (auto& conn : connections) {
+    if (conn.isConfigured() && conn.deliveryLost()) return true;
+  }
+  return false;
+}
+
+void mqttSetPersistentSession(bool persistent) {
+  persistentSession = persistent;
+}
+
+int getMqttActiveSubscriptions() {
+  int count = 0;
+  for (auto& conn : connections) count += conn.activeSubscriptions();
+  return count;
+}
+
+int getMqttPendingSubscriptions() {
+  int count = 0;
+  for (auto& conn : connections) count += conn.pendingSubscriptions();
+  return count;
+}
+
+bool fillMqttMessage(MqttMessage& msg, const char* topic, const char* payload, bool retained) {
+  return fillMqttMessage(msg, topic, reinterpret_cast<const uint8_t*>(payload), strlen(payload), retained);
+}
+
+bool fillMqttMessage(MqttMessage& msg, const char* topic, const uint8_t* payload, size_t length,
+                     bool retained) {
+  size_t topicLen = strlen(topic);
+  if (topicLen >= sizeof(msg.topic) || length > MQTT_PAYLOAD_MAX) return false;
+  memcpy(msg.topic, topic, topicLen + 1);
+  memcpy(msg.payload, payload, length);
+  msg.payload[length] = '\0';
+  msg.length = length;
+  msg.retained = retained;
+  return true;
 }
 
 void setMqttMessageCallback(InternalMqttCallback callback) {
   userCallback = callback;
 }
+
+void setMqttReadGate(MqttReadGate gate) {
+  readGate = gate;
+}
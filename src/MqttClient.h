@@ -1,24 +1,219 @@
 #pragma once
 #include <Arduino.h>
-#include <functional>
+#include <WiFi.h>
+#include <PubSubClient.h>
 #include "Config.h"
+#include "MqttTap.h"
 
-// Callback para mensajes MQTT
-using InternalMqttCallback = std::function<void(const char* topic, const char* payload)>;
+#ifdef IOTCONNECT_TLS
+#include <WiFiClientSecure.h>
+using MqttSocket = WiFiClientSecure;
+#else
+using MqttSocket = WiFiClient;
+#endif
 
-// Funciones del cliente MQTT
+// Mensaje MQTT de tamaño fijo (para colas sin memoria dinámica)
+struct MqttMessage {
+  char topic[MQTT_TOPIC_MAX];
+  char payload[MQTT_PAYLOAD_MAX + 1];  // +1 para el terminador
+  uint16_t length;
+  bool retained;
+};
+
+// Copia topic y payload en msg. false si no caben.
+bool fillMqttMessage(MqttMessage& msg, const char* topic, const char* payload, bool retained = false);
+bool fillMqttMessage(MqttMessage& msg, const char* topic, const uint8_t* payload, size_t length,
+                     bool retained = false);
+
+// Callback para mensajes MQTT (payload apunta al buffer de recepción,
+// solo es válido durante la llamada)
+using InternalMqttCallback = void (*)(const char* topic, const uint8_t* payload, unsigned int length);
+
+// Devuelve false para dejar de leer del socket (contrapresión)
+using MqttReadGate = bool (*)();
+
+// =============================================================================
+// MqttConnection - Una sesión MQTT con el broker
+// =============================================================================
+// Cada conexión tiene su propio socket, buffer, keepalive, registro de
+// suscripciones y estado de estabilidad. La conexión 0 es la principal; se
+// pueden añadir otras (mqttAddConnection) y enrutar topics a ellas por
+// prefijo (mqttRoute), p. ej. control de baja latencia + datos masivos.
+// Las funciones mqtt*() de abajo trabajan sobre ellas.
+// =============================================================================
+
+class MqttConnection {
+public:
+  MqttConnection();
+  
+  // clientIdSuffix se añade al clientId (el broker no admite dos sesiones
+  // con el mismo); el usuario sigue siendo el clientId
+  void begin(uint8_t index, uint16_t bufferSize, uint16_t keepAlive, const char* clientIdSuffix);
+  bool connect(const AppConfig& cfg);
+  void loop();
+  void disconnect();
+  
+  bool publish(const char* topic, const char* payload, bool retained);
+  // Sin las esperas de publish(): para quien ya comprobó que está estable
+  bool send(const char* topic, const char* payload, bool retained);
+  bool subscribe(const char* topic, uint8_t qos);
+  bool unsubscribe(const char* topic);
+  bool publishOkSync(const AppConfig& cfg);
+  
+  // PUBLISH de length bytes escritos por writer directamente al socket
+  bool publishStream(const char* topic, size_t length, size_t (*writer)(Print& out));
+  
+  // true cuando el broker ya recibió todo lo publicado (se comprueba con un
+  // PINGREQ: TCP entrega en orden, así que su PINGRESP llega después)
+  bool confirmDelivery();
+  
+  // Lo publicado antes de una caída no llegó a confirmarse (se limpia al
+  // volver a publicar)
+  bool deliveryLost() const { return _deliveryLost; }
+  
+  uint32_t pingInterval() const { return _pingInterval; }
+  uint32_t deadLinks() const { return _deadLinks; }
+  uint32_t unconfirmedDrops() const { return _unconfirmedDrops; }
+  
+  bool isConfigured() const { return _configured; }
+  bool connected() { return _client.connected(); }
+  bool stable() { return _stable && _client.connected(); }
+  int failCount() const { return _failCount; }
+  int state() { return _client.state(); }
+  int activeSubscriptions() const;
+  int pendingSubscriptions() const;
+  unsigned long lastAttempt() const { return _lastAttempt; }
+
+private:
+  enum class SubState : uint8_t { Free, Pending, Sent, Active, Rejected };
+  
+  struct Subscription {
+    char filter[MQTT_TOPIC_MAX];
+    uint8_t qos;
+    SubState state;
+    uint16_t packetId;
+    unsigned long sentAt;
+  };
+  
+  MqttSocket _socket;
+  MqttTapClient _tap;
+  PubSubClient _client;
+  
+  uint8_t _index = 0;
+  bool _configured = false;
+  char _suffix[16] = "";
+  char _clientId[IOTCONNECT_CONFIG_FIELD_MAX + 16];
+  char _tag[8] = "MQTT";  // Prefijo de las trazas
+  
+  int _failCount = 0;
+  unsigned long _lastAttempt = 0;
+  bool _stable = false;
+  unsigned long _stableTime = 0;
+  bool _sessionPresent = false;
+  bool _delivered = true;   // Nada publicado sin confirmar
+  bool _deliveryLost = false;
+  
+  // Keepalive propio: una vez conectado PubSubClient no envía PINGREQ
+  uint16_t _keepAlive = MQTT_KEEPALIVE;   // El del CONNECT (s)
+  uint32_t _pingInterval = 0;       // Sin tráfico durante esto, PINGREQ
+  uint32_t _pingSafe = 0;           // Mayor silencio con respuesta
+  uint32_t _pingFailed = 0;         // Menor silencio sin respuesta (0 = ninguno)
+  uint32_t _pingsSent = 0;
+  uint32_t _pingsAnswered = 0;
+  uint32_t _deliveryMark = 0;       // _pingsSent al publicar por última vez
+  uint32_t _pingIdleMs = 0;         // Silencio antes del PINGREQ en vuelo (0 = sondeo)
+  unsigned long _pingDeadline = 0;  // 0 = ningún PINGRESP pendiente
+  unsigned long _lastIn = 0;
+  unsigned long _lastOut = 0;
+  unsigned long _unansweredSince = 0;   // Enviado sin recibir nada después
+  unsigned long _lastProbe = 0;
+  bool _probing = false;            // El PINGREQ en vuelo es un sondeo
+  bool _probeFailed = false;        // El último sondeo no tuvo respuesta
+  uint32_t _seenRead = 0;
+  uint32_t _seenWritten = 0;
+  uint32_t _deadLinks = 0;
+  uint32_t _unconfirmedDrops = 0;   // Caídas con publicaciones sin confirmar
+  
+  Subscription _subs[MQTT_MAX_SUBSCRIPTIONS];
+  uint16_t _nextSubPacketId = 0xC000;  // Rango propio, PubSubClient usa ids bajos
+  
+  void pump();
+  bool waitForStability(unsigned long minMs);
+  void flushSubscriptions();
+  void serviceKeepAlive();
+  bool sendPing(uint32_t idleMs);
+  void learnInterval(bool answered, uint32_t idleMs);
+  Subscription* findSubscription(const char* filter);
+  
+  static void onTapPacket(void* context, uint8_t type, const uint8_t* data, size_t length);
+  void handleTapPacket(uint8_t type, const uint8_t* data, size_t length);
+};
+
+// Funciones del cliente MQTT (conexión principal salvo que se indique)
 void mqttBegin();
 bool mqttConnect(const AppConfig& cfg);
 void mqttLoop();
 void mqttDisconnect();
 bool publishOkSync(const AppConfig& cfg);
 
-// Funciones para IoTConnect
+// Funciones para IoTConnect (se enrutan a la conexión que toque por topic)
 bool mqttPublish(const char* topic, const char* payload, bool retained = false);
-bool mqttSubscribe(const char* topic);
+bool mqttSubscribe(const char* topic, uint8_t qos = 0);
+bool mqttUnsubscribe(const char* topic);
+bool mqttPublishStream(const char* topic, size_t length, size_t (*writer)(Print& out));
+// publish() sin esperas de estabilización (Outbox, que ya mira isMqttStableAt)
+bool mqttSend(const char* topic, const char* payload, bool retained = false);
+// Atiende la conexión de topic (lee lo que haya llegado)
+void mqttLoopFor(const char* topic);
 void setMqttMessageCallback(InternalMqttCallback callback);
+void setMqttReadGate(MqttReadGate gate);
+
+#ifdef IOTCONNECT_TLS
+// Certificado raíz del broker (antes de mqttBegin)
+void mqttSetCACert(const char* pem);
+#endif
+
+// Modo rápido (deep sleep): sin esperas de estabilización al conectar,
+// publicar ni suscribir
+void mqttSetFastMode(bool fast);
 
-// Estado del cliente MQTT
+// ¿Ha llegado al broker todo lo publicado? Pide la confirmación si falta
+bool mqttDeliveryConfirmed();
+bool mqttDeliveryLost();
+
+// Sesión persistente (cleanSession=false): si el broker la conserva,
+// no se re-suscribe tras reconectar
+void mqttSetPersistentSession(bool persistent);
+
+// Suscripciones confirmadas por SUBACK / pendientes de enviar o confirmar
+int getMqttActiveSubscriptions();
+int getMqttPendingSubscriptions();
+
+// Conexiones adicionales: devuelve el índice (-1 si no quedan huecos).
+// Llamar antes de mqttBegin(). bufferSize = 0 usa MQTT_BUFFER_SIZE.
+int mqttAddConnection(const char* clientIdSuffix, uint16_t bufferSize = 0,
+                      uint16_t keepAlive = MQTT_KEEPALIVE);
+
+// Topics que empiezan por prefix van a la conexión indicada
+bool mqttRoute(const char* prefix, uint8_t connection);
+
+// Estado del cliente MQTT (conexión principal)
 bool isMqttConnected();
 bool isMqttStable();
 int getMqttFailCount();
+
+// Intervalo de PINGREQ aprendido (ms) y conexiones dadas por muertas por
+// falta de PINGRESP (conexión principal)
+uint32_t getMqttPingInterval();
+uint32_t getMqttDeadLinks();
+uint32_t getMqttUnconfirmedDrops();
+
+// Último estado de PubSubClient: < 0 red, 1..5 código de rechazo del CONNACK
+int getMqttState();
+
+// ¿Está conectada la conexión a la que se enruta topic?
+bool isMqttConnectedFor(const char* topic);
+
+// Índice de la conexión a la que se enruta topic y si está lista para publicar
+uint8_t mqttRouteFor(const char* topic);
+bool isMqttStableAt(uint8_t index);
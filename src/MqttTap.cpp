@@ -0,0 +1,57 @@
+#include "MqttTap.h"
+
+int MqttTapClient::read() {
+  int c = _inner.read();
+  if (c >= 0) feed(static_cast<uint8_t>(c));
+  return c;
+}
+
+int MqttTapClient::read(uint8_t* buf, size_t size) {
+  int n = _inner.read(buf, size);
+  for (int i = 0; i < n; i++) feed(buf[i]);
+  return n;
+}
+
+void MqttTapClient::reset() {
+  _state = State::Header;
+  _captured = 0;
+  _bytesRead = 0;
+  _bytesWritten = 0;
+}
+
+void MqttTapClient::feed(uint8_t b) {
+  _bytesRead++;
+
+  switch (_state) {
+    case State::Header:
+      _type = b >> 4;
+      _remaining = 0;
+      _shift = 0;
+      _captured = 0;
+      _state = State::Length;
+      break;
+
+    case State::Length:
+      // Longitud restante codificada en 7 bits por byte (máx. 4 bytes)
+      _remaining |= static_cast<uint32_t>(b & 0x7F) << _shift;
+      _shift += 7;
+      if ((b & 0x80) == 0 || _shift >= 28) {
+        if (_remaining == 0) {
+          finishPacket();
+        } else {
+          _state = State::Body;
+        }
+      }
+      break;
+
+    case State::Body:
+      if (_captured < CAPTURE_SIZE) _capture[_captured++] = b;
+      if (--_remaining == 0) finishPacket();
+      break;
+  }
+}
+
+void MqttTapClient::finishPacket() {
+  _state = State::Header;
+  if (_handler) _handler(_context, _type, _capture, _captured);
+}
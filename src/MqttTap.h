@@ -0,0 +1,78 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+// =============================================================================
+// MqttTapClient - Client que observa los paquetes MQTT recibidos
+// =============================================================================
+// PubSubClient descarta en silencio CONNACK, SUBACK, PUBACK y PINGRESP. Este
+// envoltorio se coloca entre PubSubClient y el WiFiClient, reenvía todas las
+// llamadas y va analizando la cabecera fija de cada paquete que PubSubClient
+// lee. Al completarse un paquete se avisa al handler con el tipo y los
+// primeros bytes del cuerpo (cabecera variable), sin copiar el resto.
+// =============================================================================
+
+class MqttTapClient : public Client {
+public:
+  // type: tipo de paquete MQTT (1..15), data: primeros bytes del cuerpo
+  using PacketHandler = void (*)(void* context, uint8_t type, const uint8_t* data, size_t length);
+
+  static constexpr size_t CAPTURE_SIZE = 32;
+
+  explicit MqttTapClient(WiFiClient& inner) : _inner(inner) {}
+
+  void onPacket(PacketHandler handler, void* context) {
+    _handler = handler;
+    _context = context;
+  }
+
+  // Contadores de bytes desde el último connect()
+  uint32_t bytesRead() const { return _bytesRead; }
+  uint32_t bytesWritten() const { return _bytesWritten; }
+
+  int connect(IPAddress ip, uint16_t port) { reset(); return _inner.connect(ip, port); }
+  int connect(const char* host, uint16_t port) { reset(); return _inner.connect(host, port); }
+  int connect(IPAddress ip, uint16_t port, int32_t timeout) { reset(); return _inner.connect(ip, port, timeout); }
+  int connect(const char* host, uint16_t port, int32_t timeout) { reset(); return _inner.connect(host, port, timeout); }
+
+  size_t write(uint8_t b) {
+    size_t n = _inner.write(b);
+    _bytesWritten += n;
+    return n;
+  }
+  size_t write(const uint8_t* buf, size_t size) {
+    size_t n = _inner.write(buf, size);
+    _bytesWritten += n;
+    return n;
+  }
+
+  int available() { return _inner.available(); }
+  int read();
+  int read(uint8_t* buf, size_t size);
+  int peek() { return _inner.peek(); }
+  void flush() { _inner.flush(); }
+  void stop() { _inner.stop(); }
+  uint8_t connected() { return _inner.connected(); }
+  operator bool() { return _inner; }
+
+private:
+  enum class State : uint8_t { Header, Length, Body };
+
+  WiFiClient& _inner;
+  PacketHandler _handler = nullptr;
+  void* _context = nullptr;
+
+  State _state = State::Header;
+  uint8_t _type = 0;
+  uint32_t _remaining = 0;
+  uint8_t _shift = 0;
+  uint8_t _capture[CAPTURE_SIZE];
+  size_t _captured = 0;
+
+  uint32_t _bytesRead = 0;
+  uint32_t _bytesWritten = 0;
+
+  void reset();
+  void feed(uint8_t b);
+  void finishPacket();
+};
@@ -1,15 +1,67 @@
 #include "Net.h"
+#include "Log.h"
+#include "Trace.h"
 #include <WiFi.h>
 
 static unsigned long lastRetryTime = 0;
 
+// Roaming
+static bool roamEnabled = false;
+static int8_t roamThreshold = -75;
+static uint8_t roamMargin = 8;
+static uint32_t roamInterval = 60000;
+static bool roamScanning = false;
+static int16_t rssiAvg = 0;           // Media móvil, 0 = sin muestras
+static uint8_t rssiBssid[6];          // AP al que corresponde la media
+static unsigned long lastRssiSample = 0;
+static unsigned long lastRoamScan = 0;
+static unsigned long lastRoam = 0;
+static const AppConfig* pinnedCfg = nullptr;  // Asociada a un BSSID concreto
+static unsigned long roamStart = 0;            // Cambio de AP en curso (0 = no)
+static constexpr unsigned long ROAM_TIMEOUT_MS = 5000;
+
+static constexpr uint32_t ROAM_SCAN_MS_PER_CHAN = 80;   // Poco tiempo fuera de canal
+static constexpr unsigned long ROAM_SAMPLE_MS = 1000;
+
+// Sobrevive al deep sleep (no a un reset ni a un corte de alimentación)
+struct WifiCache {
+  uint32_t magic;
+  char ssid[33];
+  uint8_t bssid[6];
+  int32_t channel;
+  uint32_t ip, gateway, subnet, dns;
+};
+
+static constexpr uint32_t WIFI_CACHE_MAGIC = 0x10C0FA57;
+RTC_DATA_ATTR static WifiCache wifiCache;
+
+static void saveWifiCache(const AppConfig& cfg) {
+  const uint8_t* bssid = WiFi.BSSID();
+  if (!bssid) return;
+  strlcpy(wifiCache.ssid, cfg.ssid, sizeof(wifiCache.ssid));
+  memcpy(wifiCache.bssid, bssid, sizeof(wifiCache.bssid));
+  wifiCache.channel = WiFi.channel();
+  wifiCache.ip = WiFi.localIP();
+  wifiCache.gateway = WiFi.gatewayIP();
+  wifiCache.subnet = WiFi.subnetMask();
+  wifiCache.dns = WiFi.dnsIP();
+  wifiCache.magic = WIFI_CACHE_MAGIC;
+}
+
 bool connectWifi(const AppConfig& cfg, uint32_t timeoutMs) {
+  IOT_TRACE("wifi.connect");
   if (strlen(cfg.ssid) == 0) {
-    Serial.println("[NET] Error: SSID vacío");
+    IOT_LOG("[NET] Error: SSID vacío");
     return false;
   }
 
-  Serial.printf("[NET] Conectando a WiFi: %s\n", cfg.ssid);
+  // Ya conectada (p. ej. probada desde el portal)
+  if (WiFi.status() == WL_CONNECTED && strcmp(WiFi.SSID().c_str(), cfg.ssid) == 0) {
+    saveWifiCache(cfg);
+    return true;
+  }
+
+  IOT_LOGF("[NET] Conectando a WiFi: %s\n", cfg.ssid);
   
   WiFi.mode(WIFI_STA);
   WiFi.begin(cfg.ssid, cfg.pass);
@@ -17,31 +69,159 @@ bool connectWifi(const AppConfig& cfg, uint32_t timeoutMs) {
   unsigned long startTime = millis();
   while (WiFi.status() != WL_CONNECTED && (millis() - startTime) < timeoutMs) {
     delay(500);
-    Serial.print(".");
+    IOT_LOGF(".");
   }
-  Serial.println();
+  IOT_LOG();
   
   if (WiFi.status() == WL_CONNECTED) {
-    Serial.printf("[NET] WiFi conectado! IP: %s\n", WiFi.localIP().toString().c_str());
+    IOT_LOGF("[NET] WiFi conectado! IP: %s\n", WiFi.localIP().toString().c_str());
+    saveWifiCache(cfg);
     return true;
   }
   
-  Serial.printf("[NET] Error conectando WiFi (timeout %dms)\n", timeoutMs);
+  IOT_LOGF("[NET] Error conectando WiFi (timeout %dms)\n", timeoutMs);
+  return false;
+}
+
+bool connectWifiFast(const AppConfig& cfg, uint32_t timeoutMs) {
+  IOT_TRACE("wifi.connectFast");
+  if (wifiCache.magic != WIFI_CACHE_MAGIC || strcmp(wifiCache.ssid, cfg.ssid) != 0) {
+    IOT_LOG("[NET] Sin datos de la última conexión");
+    return false;
+  }
+
+  IOT_LOGF("[NET] Reconexión rápida a %s (canal %ld)\n", cfg.ssid, (long)wifiCache.channel);
+  WiFi.mode(WIFI_STA);
+  WiFi.config(IPAddress(wifiCache.ip), IPAddress(wifiCache.gateway), IPAddress(wifiCache.subnet),
+              IPAddress(wifiCache.dns));
+  WiFi.begin(cfg.ssid, cfg.pass, wifiCache.channel, wifiCache.bssid);
+
+  unsigned long startTime = millis();
+  while (WiFi.status() != WL_CONNECTED && (millis() - startTime) < timeoutMs) {
+    delay(10);
+  }
+
+  if (WiFi.status() == WL_CONNECTED) {
+    IOT_LOGF("[NET] WiFi conectado en %lu ms\n", millis() - startTime);
+    return true;
+  }
+
+  // El AP o la red cambiaron: volver a DHCP y escaneo normal
+  IOT_LOG("[NET] Reconexión rápida fallida, descartando caché");
+  wifiCache.magic = 0;
+  WiFi.disconnect();
+  WiFi.config(IPAddress(), IPAddress(), IPAddress());
   return false;
 }
 
 bool ensureWifi(uint32_t retryMs) {
-  if (WiFi.status() == WL_CONNECTED) return true;
+  if (WiFi.status() == WL_CONNECTED) {
+    if (roamStart) {
+      IOT_LOGF("[NET] Cambio de AP en %lu ms\n", millis() - roamStart);
+      roamStart = 0;
+      if (pinnedCfg) saveWifiCache(*pinnedCfg);
+    }
+    return true;
+  }
   
   unsigned long now = millis();
+  if (roamStart) {
+    // Dar tiempo a la asociación con el AP elegido antes de soltarlo
+    if (now - roamStart < ROAM_TIMEOUT_MS) return false;
+    IOT_LOG("[NET] No se pudo cambiar de AP");
+    roamStart = 0;
+    lastRetryTime = now - retryMs;
+  }
   if (now - lastRetryTime < retryMs) return false;
   
   lastRetryTime = now;
-  Serial.println("[NET] WiFi desconectado, reintentando...");
-  WiFi.reconnect();
+  IOT_LOG("[NET] WiFi desconectado, reintentando...");
+  if (pinnedCfg) {
+    // reconnect() repetiría el BSSID del roaming: volver a cualquier AP
+    WiFi.begin(pinnedCfg->ssid, pinnedCfg->pass);
+    pinnedCfg = nullptr;
+  } else {
+    WiFi.reconnect();
+  }
   return false;
 }
 
+void wifiSetRoaming(int8_t thresholdDbm, uint8_t marginDb, uint32_t scanIntervalMs) {
+  roamEnabled = true;
+  roamThreshold = thresholdDbm;
+  roamMargin = marginDb;
+  roamInterval = scanIntervalMs;
+}
+
+// Media móvil del RSSI del AP actual (un valor suelto no basta para cambiar)
+static void sampleRssi() {
+  unsigned long now = millis();
+  if (rssiAvg != 0 && now - lastRssiSample < ROAM_SAMPLE_MS) return;
+  lastRssiSample = now;
+
+  const uint8_t* bssid = WiFi.BSSID();
+  int8_t rssi = WiFi.RSSI();
+  if (!bssid || rssi == 0) return;
+  if (rssiAvg == 0 || memcmp(bssid, rssiBssid, sizeof(rssiBssid)) != 0) {
+    memcpy(rssiBssid, bssid, sizeof(rssiBssid));
+    rssiAvg = rssi;
+  } else {
+    rssiAvg = (rssiAvg * 3 + rssi) / 4;
+  }
+}
+
+bool wifiRoamCheck(const AppConfig& cfg, uint8_t* bssid, int32_t* channel) {
+  if (!roamEnabled || WiFi.status() != WL_CONNECTED) return false;
+  sampleRssi();
+  unsigned long now = millis();
+
+  if (!roamScanning) {
+    if (rssiAvg == 0 || rssiAvg >= roamThreshold) return false;
+    if (now - lastRoamScan < roamInterval || (lastRoam && now - lastRoam < roamInterval)) return false;
+    lastRoamScan = now;
+    // Asíncrono y solo este SSID: la conexión sigue activa mientras tanto
+    if (WiFi.scanNetworks(true, false, false, ROAM_SCAN_MS_PER_CHAN, 0, cfg.ssid) == WIFI_SCAN_FAILED) {
+      return false;
+    }
+    roamScanning = true;
+    IOT_LOGF("[NET] RSSI %d dBm, buscando un AP mejor\n", rssiAvg);
+    return false;
+  }
+
+  int16_t found = WiFi.scanComplete();
+  if (found == WIFI_SCAN_RUNNING) return false;
+  roamScanning = false;
+  if (found < 0) return false;
+
+  // Registros del escaneo tal cual: SSID(i)/BSSIDstr(i) crearían String
+  const wifi_ap_record_t* best = nullptr;
+  for (int16_t i = 0; i < found; i++) {
+    auto* ap = static_cast<const wifi_ap_record_t*>(WiFi.getScanInfoByIndex(i));
+    if (!ap || strcmp(reinterpret_cast<const char*>(ap->ssid), cfg.ssid) != 0) continue;
+    if (memcmp(ap->bssid, rssiBssid, sizeof(rssiBssid)) == 0) continue;
+    if (!best || ap->rssi > best->rssi) best = ap;
+  }
+  // Histéresis: solo si la mejora supera el margen
+  bool roam = best && best->rssi >= rssiAvg + roamMargin;
+  if (roam) {
+    memcpy(bssid, best->bssid, 6);
+    *channel = best->primary;
+    IOT_LOGF("[NET] AP mejor: %02X:%02X:%02X:%02X:%02X:%02X a %d dBm (actual %d dBm)\n",
+             bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5], best->rssi, rssiAvg);
+  }
+  WiFi.scanDelete();
+  return roam;
+}
+
+void wifiRoamTo(const AppConfig& cfg, const uint8_t* bssid, int32_t channel) {
+  IOT_TRACE("wifi.roam");
+  lastRoam = millis();
+  rssiAvg = 0;
+  pinnedCfg = &cfg;
+  roamStart = lastRoam | 1;
+  WiFi.begin(cfg.ssid, cfg.pass, channel, bssid);
+}
+
 bool isWifiConnected() {
   return WiFi.status() == WL_CONNECTED;
 }
@@ -6,5 +6,23 @@
 bool connectWifi(const AppConfig& cfg, uint32_t timeoutMs = 15000);
 bool ensureWifi(uint32_t retryMs = 3000);
 
+// Reconexión rápida tras deep sleep: canal, BSSID e IP de la última conexión
+// (memoria RTC) para saltarse el escaneo y el DHCP. Si falla, la caché se
+// descarta y hay que usar connectWifi().
+bool connectWifiFast(const AppConfig& cfg, uint32_t timeoutMs = 3000);
+
+// Roaming entre APs con el mismo SSID (desactivado por defecto). Con la
+// media de RSSI por debajo de thresholdDbm se escanea en segundo plano, como
+// mucho cada scanIntervalMs, buscando un AP al menos marginDb más fuerte.
+void wifiSetRoaming(int8_t thresholdDbm, uint8_t marginDb, uint32_t scanIntervalMs);
+
+// Llamar con la WiFi conectada. true si hay que cambiar al AP devuelto en
+// bssid/channel; no cambia de AP por sí misma.
+bool wifiRoamCheck(const AppConfig& cfg, uint8_t* bssid, int32_t* channel);
+
+// Empieza a asociar con ese AP concreto, sin bloquear. ensureWifi() sigue
+// la asociación y, si en 5 s no lo consigue, vuelve a cualquier AP del SSID.
+void wifiRoamTo(const AppConfig& cfg, const uint8_t* bssid, int32_t channel);
+
 // Estado de la conexión
 bool isWifiConnected();
@@ -0,0 +1,238 @@
+#include "Ota.h"
+
+#ifndef IOTCONNECT_NO_OTA
+
+#include "Log.h"
+#include "Config.h"
+#include "MqttClient.h"
+#include <Update.h>
+#include "mbedtls/sha256.h"
+
+enum class OtaStatus : uint8_t { None, Ready, Ack, Done, Error };
+
+static char inPrefix[MQTT_TOPIC_MAX];   // <publicId>/ota/in/
+static char outTopic[MQTT_TOPIC_MAX];   // <publicId>/ota/out
+static size_t inPrefixLen = 0;
+
+static bool active = false;
+static uint32_t totalSize = 0;
+static uint32_t offset = 0;             // Bytes escritos en orden
+static uint8_t expectedHash[32];
+static mbedtls_sha256_context sha;
+
+// Lo que otaService() debe publicar (el callback no publica)
+static OtaStatus status = OtaStatus::None;
+static uint32_t statusSeq = 0;          // Cambia con cada setStatus()
+static const char* errorReason = "";
+static unsigned long lastProgress = 0;
+static unsigned long lastNudge = 0;
+static bool wasStable = false;
+
+static constexpr unsigned long OTA_NUDGE_MS = 5000;      // Sin trozos: repetir ready
+static constexpr unsigned long OTA_TIMEOUT_MS = 300000;  // Sin trozos: abandonar
+
+static void forceStatus(OtaStatus next) {
+  status = next;
+  statusSeq++;
+}
+
+static void setStatus(OtaStatus next) {
+  // Un error o el final no se pisan con un ack posterior
+  if (status == OtaStatus::Error || status == OtaStatus::Done) return;
+  forceStatus(next);
+}
+
+static void fail(const char* reason) {
+  IOT_LOGF("[OTA] Error: %s\n", reason);
+  if (active) {
+    IOT_LOG("[OTA] Otro firmware: se descarta el que estaba a medias");
+    Update.abort();
+    mbedtls_sha256_free(&sha);
+  }
+  active = false;
+  errorReason = reason;
+  forceStatus(OtaStatus::Error);
+}
+
+static bool parseHex(const char* hex, uint8_t* out, size_t size) {
+  for (size_t i = 0; i < size; i++) {
+    unsigned value;
+    if (sscanf(hex + i * 2, "%2x", &value) != 1) return false;
+    out[i] = value;
+  }
+  return hex[size * 2] == '\0' || hex[size * 2] == '\n';
+}
+
+static void handleBegin(const uint8_t* payload, size_t length) {
+  char text[96];
+  if (length >= sizeof(text)) return fail("begin inválido");
+  memcpy(text, payload, length);
+  text[length] = '\0';
+
+  char* comma = strchr(text, ',');
+  uint32_t size = strtoul(text, nullptr, 10);
+  uint8_t hash[32];
+  if (!comma || size == 0 || !parseHex(comma + 1, hash, sizeof(hash))) {
+    return fail("begin inválido");
+  }
+
+  // Mismo firmware ya a medias: seguir donde se quedó. Otro distinto, aunque
+  // mida lo mismo, empieza de cero
+  if (active && size == totalSize && memcmp(hash, expectedHash, sizeof(hash)) == 0) {
+    IOT_LOGF("[OTA] Reanudando en %lu/%lu\n", (unsigned long)offset, (unsigned long)totalSize);
+    forceStatus(OtaStatus::Ready);
+    return;
+  }
+
+  if (active) {
+    Update.abort();
+    mbedtls_sha256_free(&sha);
+  }
+  active = false;
+  forceStatus(OtaStatus::None);
+  if (!Update.begin(size)) return fail(Update.errorString());
+  memcpy(expectedHash, hash, sizeof(expectedHash));
+
+  mbedtls_sha256_init(&sha);
+  mbedtls_sha256_starts(&sha, 0);
+  active = true;
+  totalSize = size;
+  offset = 0;
+  lastProgress = millis();
+  forceStatus(OtaStatus::Ready);
+  IOT_LOGF("[OTA] Inicio: %lu bytes\n", (unsigned long)size);
+}
+
+static void handleChunk(uint32_t chunkOffset, const uint8_t* payload, size_t length) {
+  if (!active) return;
+  if (chunkOffset != offset) {
+    // Hueco: pedir que siga desde offset. Repetido: se perdió el ack
+    setStatus(chunkOffset > offset ? OtaStatus::Ready : OtaStatus::Ack);
+    return;
+  }
+  if (length == 0 || offset + length > totalSize) return fail("trozo fuera de rango");
+
+  // Update.write no modifica los datos, pero no los declara const
+  if (Update.write(const_cast<uint8_t*>(payload), length) != length) {
+    return fail(Update.errorString());
+  }
+  mbedtls_sha256_update(&sha, payload, length);
+  offset += length;
+  lastProgress = millis();
+  setStatus(OtaStatus::Ack);
+}
+
+static void handleEnd() {
+  if (!active) return;
+  if (offset != totalSize) {
+    setStatus(OtaStatus::Ready);
+    return;
+  }
+
+  uint8_t hash[32];
+  mbedtls_sha256_finish(&sha, hash);
+  mbedtls_sha256_free(&sha);
+  if (memcmp(hash, expectedHash, sizeof(hash)) != 0) {
+    Update.abort();
+    active = false;
+    errorReason = "sha256 no coincide";
+    forceStatus(OtaStatus::Error);
+    IOT_LOG("[OTA] Error: sha256 no coincide");
+    return;
+  }
+  if (!Update.end()) {
+    active = false;
+    errorReason = Update.errorString();
+    forceStatus(OtaStatus::Error);
+    return;
+  }
+  active = false;
+  forceStatus(OtaStatus::Done);
+  IOT_LOG("[OTA] Firmware verificado");
+}
+
+bool otaBegin(const char* publicId) {
+  int len = snprintf(inPrefix, sizeof(inPrefix), "%s/ota/in/", publicId);
+  if (len < 0 || (size_t)len + 2 >= sizeof(inPrefix)) return false;
+  inPrefixLen = len;
+  snprintf(outTopic, sizeof(outTopic), "%s/ota/out", publicId);
+
+  char filter[MQTT_TOPIC_MAX];
+  snprintf(filter, sizeof(filter), "%s#", inPrefix);
+  return mqttSubscribe(filter, 1);
+}
+
+bool otaHandle(const char* topic, const uint8_t* payload, size_t length) {
+  if (inPrefixLen == 0 || strncmp(topic, inPrefix, inPrefixLen) != 0) return false;
+  const char* command = topic + inPrefixLen;
+
+  if (strncmp(command, "c/", 2) == 0) {
+    handleChunk(strtoul(command + 2, nullptr, 10), payload, length);
+  } else if (strcmp(command, "begin") == 0) {
+    handleBegin(payload, length);
+  } else if (strcmp(command, "end") == 0) {
+    handleEnd();
+  } else if (strcmp(command, "abort") == 0) {
+    if (active) fail("cancelado");
+  }
+  return true;
+}
+
+void otaService() {
+  bool stable = isMqttStable();
+  bool reconnected = stable && !wasStable;
+  wasStable = stable;
+  if (!stable || inPrefixLen == 0) return;
+
+  unsigned long now = millis();
+  if (active) {
+    if (reconnected) setStatus(OtaStatus::Ready);
+    if (now - lastProgress > OTA_TIMEOUT_MS) {
+      fail("tiempo agotado");
+    } else if (status == OtaStatus::None && now - lastProgress > OTA_NUDGE_MS &&
+               now - lastNudge > OTA_NUDGE_MS) {
+      // Se perdió el último ack o trozo: recordar por dónde vamos
+      lastNudge = now;
+      setStatus(OtaStatus::Ready);
+    }
+  }
+  if (status == OtaStatus::None) return;
+
+  char payload[64];
+  switch (status) {
+    case OtaStatus::Ready:
+      snprintf(payload, sizeof(payload), "ready,%lu,%u", (unsigned long)offset, (unsigned)OTA_WINDOW);
+      break;
+    case OtaStatus::Ack:
+      snprintf(payload, sizeof(payload), "ack,%lu", (unsigned long)offset);
+      break;
+    case OtaStatus::Done:
+      snprintf(payload, sizeof(payload), "done,%lu", (unsigned long)totalSize);
+      break;
+    default:
+      snprintf(payload, sizeof(payload), "error,%s", errorReason);
+      break;
+  }
+  // Publicar procesa paquetes: puede llegar otro trozo y cambiar el estado
+  OtaStatus sending = status;
+  uint32_t seq = statusSeq;
+  if (!mqttPublish(outTopic, payload)) return;  // Se reintenta en la siguiente llamada
+
+  if (sending == OtaStatus::Done) {
+    IOT_LOG("[OTA] Reiniciando con el nuevo firmware...");
+    // Esperar a que el "done" llegue al broker antes de cortar
+    unsigned long start = millis();
+    while (!mqttDeliveryConfirmed() && millis() - start < 2000) {
+      mqttLoop();
+      delay(10);
+    }
+    ESP.restart();
+  }
+  if (statusSeq == seq) status = OtaStatus::None;
+}
+
+bool otaActive() {
+  return active;
+}
+
+#endif  // IOTCONNECT_NO_OTA
@@ -0,0 +1,48 @@
+#pragma once
+#include <Arduino.h>
+
+// =============================================================================
+// Ota - Actualización de firmware por MQTT
+// =============================================================================
+// El firmware llega en trozos binarios y cada trozo se escribe en la
+// partición de actualización directamente desde el buffer de recepción de
+// PubSubClient, sin copias intermedias ni heap. Topics (p = publicId):
+//
+//   p/ota/in/begin       "<tamaño>,<sha256 hex>"   Empieza (o reinicia)
+//   p/ota/in/c/<offset>  bytes del firmware         Un trozo
+//   p/ota/in/end                                    Verificar y reiniciar
+//   p/ota/in/abort                                  Cancelar
+//
+//   p/ota/out            "ready,<offset>,<ventana>" Enviar desde offset
+//                        "ack,<offset>"             Recibido hasta offset
+//                        "done,<tamaño>"            Verificado, reiniciando
+//                        "error,<motivo>"
+//
+// Control de flujo: el servidor no debe tener más de <ventana> trozos sin
+// confirmar por "ack". Los trozos fuera de orden se ignoran y se responde
+// "ready" con el offset esperado; lo mismo tras una reconexión, de modo que
+// la descarga continúa donde se quedó. El SHA-256 se calcula sobre la marcha.
+// Cada trozo debe caber en el buffer MQTT junto con su topic.
+// =============================================================================
+
+#ifdef IOTCONNECT_NO_OTA
+// OTA desactivado en compilación: no se enlaza nada de Ota.cpp (ni Update)
+inline bool otaBegin(const char*) { return false; }
+inline bool otaHandle(const char*, const uint8_t*, size_t) { return false; }
+inline void otaService() {}
+inline bool otaActive() { return false; }
+#else
+// Suscribe a p/ota/in/# (llamar con la conexión MQTT configurada)
+bool otaBegin(const char* publicId);
+
+// Procesa un mensaje recibido. true si era de OTA (ya no hay que encolarlo).
+// Se llama desde el callback de MQTT: no publica, solo marca lo pendiente.
+bool otaHandle(const char* topic, const uint8_t* payload, size_t length);
+
+// Publica el estado pendiente y reinicia tras una actualización correcta.
+// Llamar desde el mismo task que atiende MQTT.
+void otaService();
+
+// ¿Hay una actualización en curso?
+bool otaActive();
+#endif
@@ -0,0 +1,151 @@
+#include "Outbox.h"
+
+#ifndef IOTCONNECT_NO_OUTBOX
+
+#include "Log.h"
+#include "Config.h"
+#include "RingBuffer.h"
+
+struct TokenBucket {
+  float rate = 0;        // Tokens por segundo (0 = sin límite)
+  float burst = 0;
+  float tokens = 0;
+  unsigned long last = 0;
+};
+
+struct ParkedMessage {
+  uint8_t cls;
+  MqttMessage msg;
+};
+
+static RingBuffer<MqttMessage, OUTBOX_QUEUE_LEN> queues[OUTBOX_CLASSES];
+// Solo los usa el task que envía
+static RingBuffer<ParkedMessage, OUTBOX_PARKED> parked[MQTT_MAX_CONNECTIONS];
+static volatile uint8_t parkedCount[OUTBOX_CLASSES] = {0, 0, 0};
+static bool blocked[OUTBOX_CLASSES];   // Apartados llenos en esta pasada
+static TokenBucket buckets[OUTBOX_CLASSES];
+static uint8_t weights[OUTBOX_CLASSES] = {1, 4, 1};
+static uint8_t credits[OUTBOX_CLASSES] = {0, 0, 0};
+static uint32_t discarded = 0;
+
+static bool hasToken(uint8_t cls) {
+  TokenBucket& b = buckets[cls];
+  if (b.rate <= 0) return true;
+
+  unsigned long now = millis();
+  b.tokens += (now - b.last) * b.rate / 1000.0f;
+  if (b.tokens > b.burst) b.tokens = b.burst;
+  b.last = now;
+  return b.tokens >= 1.0f;
+}
+
+static bool ready(uint8_t cls) {
+  return !blocked[cls] && !queues[cls].empty() && hasToken(cls);
+}
+
+// Clase a servir: la crítica si puede, si no la siguiente con créditos.
+// Cuando nadie tiene créditos empieza una ronda nueva.
+static int pickClass() {
+  if (ready(0)) return 0;
+
+  for (int round = 0; round < 2; round++) {
+    for (uint8_t cls = 1; cls < OUTBOX_CLASSES; cls++) {
+      if (credits[cls] > 0 && ready(cls)) return cls;
+    }
+    for (uint8_t cls = 1; cls < OUTBOX_CLASSES; cls++) credits[cls] = weights[cls];
+  }
+  return -1;
+}
+
+bool outboxPush(uint8_t cls, const MqttMessage& msg) {
+  if (cls >= OUTBOX_CLASSES) return false;
+  return queues[cls].push(msg);
+}
+
+// false si la conexión se cayó y hay que conservarlo. Si sigue viva y el
+// broker no lo acepta, el mensaje no se puede enviar y se descarta.
+static bool send(const MqttMessage& msg) {
+  // Solo se llega con la conexión estable: sin las esperas de mqttPublish(),
+  // que con una ráfaga de bulk retrasarían lo crítico decenas de ms
+  if (mqttSend(msg.topic, msg.payload, msg.retained)) return true;
+  if (!isMqttConnectedFor(msg.topic)) return false;
+  IOT_LOGF("[MQTT] Outbox: descartado %s\n", msg.topic);
+  discarded++;
+  return true;
+}
+
+static bool park(uint8_t conn, uint8_t cls, const MqttMessage& msg) {
+  static ParkedMessage slot;
+  slot.cls = cls;
+  slot.msg = msg;
+  if (!parked[conn].push(slot)) return false;
+  parkedCount[cls]++;
+  return true;
+}
+
+size_t outboxService(size_t budget) {
+  size_t sent = 0;
+
+  // Lo apartado de las conexiones que han vuelto sale primero, en orden
+  for (uint8_t conn = 0; conn < MQTT_MAX_CONNECTIONS; conn++) {
+    ParkedMessage* slot;
+    while (sent < budget && isMqttStableAt(conn) && (slot = parked[conn].front())) {
+      if (!send(slot->msg)) break;
+      parkedCount[slot->cls]--;
+      parked[conn].drop();
+      sent++;
+    }
+  }
+
+  for (uint8_t cls = 0; cls < OUTBOX_CLASSES; cls++) blocked[cls] = false;
+
+  while (sent < budget) {
+    int cls = pickClass();
+    if (cls < 0) break;
+
+    MqttMessage* msg = queues[cls].front();
+    uint8_t conn = mqttRouteFor(msg->topic);
+    // Con la conexión caída (o con apartados delante) se aparta para que no
+    // frene al resto; si no cabe, la clase espera
+    bool down = !isMqttStableAt(conn) || !parked[conn].empty();
+    if (down || !send(*msg)) {
+      if (park(conn, cls, *msg)) {
+        queues[cls].drop();
+      } else {
+        blocked[cls] = true;
+      }
+      continue;
+    }
+    queues[cls].drop();
+
+    if (buckets[cls].rate > 0) buckets[cls].tokens -= 1.0f;
+    if (credits[cls] > 0) credits[cls]--;
+    sent++;
+  }
+  return sent;
+}
+
+void outboxSetWeight(uint8_t cls, uint8_t weight) {
+  if (cls >= OUTBOX_CLASSES || weight == 0) return;
+  weights[cls] = weight;
+}
+
+void outboxSetRateLimit(uint8_t cls, float ratePerSec, uint8_t burst) {
+  if (cls >= OUTBOX_CLASSES) return;
+  TokenBucket& b = buckets[cls];
+  b.rate = ratePerSec;
+  b.burst = burst > 0 ? burst : 1;
+  b.tokens = b.burst;
+  b.last = millis();
+}
+
+size_t outboxDepth(uint8_t cls) {
+  if (cls >= OUTBOX_CLASSES) return 0;
+  return queues[cls].size() + parkedCount[cls];
+}
+
+uint32_t outboxDiscardedCount() {
+  return discarded;
+}
+
+#endif  // IOTCONNECT_NO_OUTBOX
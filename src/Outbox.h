@@ -0,0 +1,55 @@
+#pragma once
+#include <Arduino.h>
+#include "MqttClient.h"
+
+// =============================================================================
+// Outbox - Cola de salida por clases de prioridad
+// =============================================================================
+// Una cola por clase (0 = crítica, 1 = normal, 2 = bulk). outboxService()
+// envía primero todo lo crítico y reparte el resto por round-robin ponderado
+// según el peso de cada clase. Cada clase puede tener además un límite de
+// tasa (token bucket).
+//
+// Un mensaje cuya conexión está caída se aparta (OUTBOX_PARKED por conexión)
+// para no frenar a los de las demás, y sale antes que nada cuando vuelve.
+// Si los apartados se llenan, esa clase espera a que la conexión vuelva.
+//
+// Un único task encola (outboxPush) y otro puede enviar (outboxService).
+// =============================================================================
+
+constexpr uint8_t OUTBOX_CLASSES = 3;
+
+#ifdef IOTCONNECT_NO_OUTBOX
+// Sin colas de salida: cada mensaje se envía al publicarlo, sin prioridades,
+// tasa ni apartados, y se pierde si su conexión no está estable. No se enlaza
+// nada de Outbox.cpp. Solo vale sin enableNetworkTask (se envía desde el task
+// de la app).
+inline bool outboxPush(uint8_t cls, const MqttMessage& msg) {
+  if (cls >= OUTBOX_CLASSES || !isMqttStableAt(mqttRouteFor(msg.topic))) return false;
+  return mqttSend(msg.topic, msg.payload, msg.retained);
+}
+inline size_t outboxService(size_t) { return 0; }
+inline void outboxSetWeight(uint8_t, uint8_t) {}
+inline void outboxSetRateLimit(uint8_t, float, uint8_t) {}
+inline size_t outboxDepth(uint8_t) { return 0; }
+inline uint32_t outboxDiscardedCount() { return 0; }
+#else
+// Encola una copia del mensaje. false si la cola de esa clase está llena.
+bool outboxPush(uint8_t cls, const MqttMessage& msg);
+
+// Envía como mucho `budget` mensajes. Devuelve cuántos se enviaron.
+size_t outboxService(size_t budget);
+
+// Peso en el round-robin (mensajes por ronda; la clase 0 no lo usa)
+void outboxSetWeight(uint8_t cls, uint8_t weight);
+
+// Límite de tasa: ratePerSec mensajes/s con ráfagas de hasta burst.
+// ratePerSec = 0 quita el límite.
+void outboxSetRateLimit(uint8_t cls, float ratePerSec, uint8_t burst);
+
+// Mensajes pendientes en una clase (incluidos los apartados)
+size_t outboxDepth(uint8_t cls);
+
+// Mensajes descartados porque el broker no los aceptó con la conexión viva
+uint32_t outboxDiscardedCount();
+#endif
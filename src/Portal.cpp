@@ -1,5 +1,9 @@
 #include "Portal.h"
+#include "Log.h"
+
+#ifndef IOTCONNECT_NO_PORTAL
 #include "Config.h"
+#include "MqttClient.h"
 #include <WiFi.h>
 #include <WebServer.h>
 #include <DNSServer.h>
@@ -10,7 +14,22 @@ static WebServer server(80);
 static DNSServer dnsServer;
 static bool portalActive = false;
 static unsigned long lastScanTime = 0;
-static String scanResults = "";
+
+// Resultado del escaneo ya serializado (buffers fijos, sin heap)
+static char scanResults[SCAN_MAX_NETWORKS * 80 + 32] = "";
+static StaticJsonDocument<JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(SCAN_MAX_NETWORKS) +
+                          SCAN_MAX_NETWORKS * JSON_OBJECT_SIZE(3)> scanDoc;
+
+// Prueba en vivo de las credenciales enviadas en /save (AP+STA). La
+// configuración solo se guarda si WiFi, MQTT y el sync funcionan.
+enum class TestState : uint8_t { Idle, Wifi, Mqtt, Sync, Done, Error };
+
+static TestState testState = TestState::Idle;
+static unsigned long testStart = 0;
+static const char* testError = "";
+
+static constexpr unsigned long TEST_WIFI_TIMEOUT_MS = 15000;
+static constexpr unsigned long TEST_DONE_GRACE_MS = 3000;  // Para que la web vea "done"
 
 // HTML del portal (PROGMEM para ahorrar RAM)
 const char HTML_PORTAL[] PROGMEM = R"html(
@@ -207,138 +226,254 @@ const char HTML_CONNECTING[] PROGMEM = R"html(
         .container { max-width: 400px; margin: 50px auto; background: white; padding: 30px; border-radius: 8px; box-shadow: 0 2px 10px rgba(0,0,0,0.1); }
         .spinner { border: 4px solid #f3f3f3; border-top: 4px solid #007cba; border-radius: 50%; width: 40px; height: 40px; animation: spin 1s linear infinite; margin: 20px auto; }
         @keyframes spin { 0% { transform: rotate(0deg); } 100% { transform: rotate(360deg); } }
+        .error { color: #c53030; }
+        .ok { color: #276749; }
+        a { color: #007cba; }
     </style>
 </head>
 <body>
     <div class="container">
-        <h1>Conectando...</h1>
-        <div class="spinner"></div>
-        <p>Configuración guardada. Conectando a WiFi y MQTT...</p>
-        <p>El dispositivo se reiniciará automáticamente.</p>
+        <h1 id="title">Conectando...</h1>
+        <div class="spinner" id="spinner"></div>
+        <p id="step">Probando la conexión WiFi...</p>
+        <p id="back" style="display:none"><a href="/">Volver a la configuración</a></p>
     </div>
     <script>
-        setTimeout(() => { window.location.href = '/'; }, 10000);
+        const steps = {
+            wifi: 'Probando la conexión WiFi...',
+            mqtt: 'WiFi OK. Conectando con el servidor...',
+            sync: 'Servidor OK. Vinculando dispositivo...'
+        };
+        function finish(title, text, cls, back) {
+            document.getElementById('title').textContent = title;
+            document.getElementById('spinner').style.display = 'none';
+            const step = document.getElementById('step');
+            step.textContent = text;
+            step.className = cls;
+            if (back) document.getElementById('back').style.display = 'block';
+        }
+        function poll() {
+            fetch('/api/status')
+                .then(response => response.json())
+                .then(data => {
+                    if (data.state === 'done') {
+                        finish('¡Conectado!', 'Configuración guardada. Ya puedes cerrar esta página.', 'ok', false);
+                    } else if (data.state === 'error') {
+                        finish('No se pudo conectar', data.error, 'error', true);
+                    } else {
+                        if (steps[data.state]) document.getElementById('step').textContent = steps[data.state];
+                        setTimeout(poll, 1000);
+                    }
+                })
+                .catch(() => setTimeout(poll, 2000));
+        }
+        poll();
     </script>
 </body>
 </html>
 )html";
 
-String replaceTemplate(const char* tmpl, const AppConfig& cfg) {
-  String html = String(tmpl);
-  html.replace("{{APP_NAME}}", g_appName);
-  html.replace("{{CLIENT_ID}}", cfg.clientId);
-  html.replace("{{TOKEN}}", cfg.token);
-  html.replace("{{PUBLIC_ID}}", cfg.publicId);
-  html.replace("{{SSID}}", cfg.ssid);
-  html.replace("{{PASS}}", cfg.pass);
-  return html;
+// Valor de un marcador {{KEY}} de las plantillas (nullptr si no existe)
+static const char* templateValue(const char* key, size_t len, const AppConfig& cfg) {
+  struct Field { const char* key; const char* value; };
+  const Field fields[] = {
+    {"APP_NAME", g_appName}, {"CLIENT_ID", cfg.clientId}, {"TOKEN", cfg.token},
+    {"PUBLIC_ID", cfg.publicId}, {"SSID", cfg.ssid}, {"PASS", cfg.pass},
+  };
+  for (const auto& f : fields) {
+    if (strlen(f.key) == len && strncmp(f.key, key, len) == 0) return f.value;
+  }
+  return nullptr;
+}
+
+// Envía la plantilla por trozos sustituyendo los marcadores al vuelo,
+// sin construir la página completa en memoria
+static void sendTemplate(const char* tmpl, const AppConfig& cfg) {
+  server.setContentLength(CONTENT_LENGTH_UNKNOWN);
+  server.send(200, "text/html", "");
+  
+  const char* p = tmpl;
+  const char* open;
+  while ((open = strstr(p, "{{")) != nullptr) {
+    const char* close = strstr(open + 2, "}}");
+    if (!close) break;
+    server.sendContent(p, open - p);
+    const char* value = templateValue(open + 2, close - open - 2, cfg);
+    if (value) server.sendContent(value, strlen(value));
+    p = close + 2;
+  }
+  server.sendContent(p, strlen(p));
+  server.sendContent("", 0);  // Fin de la respuesta por trozos
+}
+
+// Copia un argumento de la petición si existe
+static bool copyArg(const char* name, char* dst, size_t size) {
+  if (!server.hasArg(name)) return false;
+  strlcpy(dst, server.arg(name).c_str(), size);
+  return true;
+}
+
+// Serializa el último escaneo en scanResults
+static void buildScanResults(int n) {
+  scanDoc.clear();
+  JsonArray networks = scanDoc.createNestedArray("networks");
+  for (int i = 0; i < n && i < SCAN_MAX_NETWORKS; i++) {
+    auto* ap = static_cast<wifi_ap_record_t*>(WiFi.getScanInfoByIndex(i));
+    if (!ap) continue;
+    JsonObject net = networks.createNestedObject();
+    net["ssid"] = reinterpret_cast<const char*>(ap->ssid);  // Sin copia
+    net["rssi"] = ap->rssi;
+    net["enc"] = (ap->authmode != WIFI_AUTH_OPEN);
+  }
+  serializeJson(scanDoc, scanResults, sizeof(scanResults));
+  scanDoc.clear();  // Apunta a los resultados que se van a borrar
 }
 
 void handleRoot() {
   bool hasQRData = false;
   
-  if (server.hasArg("clientId") || server.hasArg("clientid")) {
-    const char* clientId = server.hasArg("clientId") ? server.arg("clientId").c_str() : server.arg("clientid").c_str();
-    strlcpy(g_cfg.clientId, clientId, sizeof(g_cfg.clientId));
-    Serial.printf("[CFG] Client ID desde GET: %s\n", g_cfg.clientId);
+  if (copyArg("clientId", g_cfg.clientId, sizeof(g_cfg.clientId)) ||
+      copyArg("clientid", g_cfg.clientId, sizeof(g_cfg.clientId))) {
+    IOT_LOGF("[CFG] Client ID desde GET: %s\n", g_cfg.clientId);
     hasQRData = true;
   }
   
-  if (server.hasArg("token")) {
-    strlcpy(g_cfg.token, server.arg("token").c_str(), sizeof(g_cfg.token));
-    Serial.printf("[CFG] Token desde GET: %s\n", g_cfg.token);
+  if (copyArg("token", g_cfg.token, sizeof(g_cfg.token))) {
+    IOT_LOGF("[CFG] Token desde GET: %s\n", g_cfg.token);
     hasQRData = true;
   }
   
-  if (server.hasArg("publicId") || server.hasArg("publicid")) {
-    const char* publicId = server.hasArg("publicId") ? server.arg("publicId").c_str() : server.arg("publicid").c_str();
-    strlcpy(g_cfg.publicId, publicId, sizeof(g_cfg.publicId));
-    Serial.printf("[CFG] Public ID desde GET: %s\n", g_cfg.publicId);
+  if (copyArg("publicId", g_cfg.publicId, sizeof(g_cfg.publicId)) ||
+      copyArg("publicid", g_cfg.publicId, sizeof(g_cfg.publicId))) {
+    IOT_LOGF("[CFG] Public ID desde GET: %s\n", g_cfg.publicId);
     hasQRData = true;
   }
 
   if (hasQRData) {
-    Serial.println("[PORTAL] Cliente conectado con datos QR");
+    IOT_LOG("[PORTAL] Cliente conectado con datos QR");
   }
 
-  String html = replaceTemplate(HTML_PORTAL, g_cfg);
-  server.send(200, "text/html", html);
+  sendTemplate(HTML_PORTAL, g_cfg);
 }
 
 void handleScan() {
-  Serial.println("[NET] Petición /scan recibida");
+  IOT_LOG("[NET] Petición /scan recibida");
   
   unsigned long now = millis();
   
   // Usar cache si el escaneo es reciente
-  if (now - lastScanTime < 5000 && scanResults.length() > 2) {
-    Serial.println("[NET] Usando cache de escaneo");
-    server.send(200, "application/json", scanResults);
+  if (now - lastScanTime < 5000 && strlen(scanResults) > 2) {
+    IOT_LOG("[NET] Usando cache de escaneo");
+    server.send_P(200, "application/json", scanResults);
     return;
   }
 
-  Serial.println("[NET] Escaneando redes WiFi...");
+  IOT_LOG("[NET] Escaneando redes WiFi...");
   
   // NO cambiar el modo WiFi aquí - ya está configurado en startPortal()
   // WiFi.mode(WIFI_AP_STA); // <-- REMOVIDO - causaba el problema
   
   int n = WiFi.scanNetworks(false, false, false, 300);  // Scan más rápido
+  IOT_LOGF("[NET] Encontradas %d redes\n", n);
   
-  DynamicJsonDocument doc(4096);
-  JsonArray networks = doc.createNestedArray("networks");
-  
-  Serial.printf("[NET] Encontradas %d redes\n", n);
-  
-  if (n > 0) {
-    for (int i = 0; i < n && i < 20; i++) {  // Limitar a 20 redes
-      JsonObject net = networks.createNestedObject();
-      net["ssid"] = WiFi.SSID(i);
-      net["rssi"] = WiFi.RSSI(i);
-      net["enc"] = (WiFi.encryptionType(i) != WIFI_AUTH_OPEN);
-    }
-  }
-  
-  scanResults = "";
-  serializeJson(doc, scanResults);
+  buildScanResults(n);
   lastScanTime = now;
   
   WiFi.scanDelete();  // Limpiar resultados del scan
   
-  server.send(200, "application/json", scanResults);
-  Serial.println("[NET] Respuesta /scan enviada");
+  server.send_P(200, "application/json", scanResults);
+  IOT_LOG("[NET] Respuesta /scan enviada");
 }
 
 void handleSave() {
-  Serial.println("[CFG] Guardando configuración desde POST");
-  
-  if (server.hasArg("clientid")) {
-    strlcpy(g_cfg.clientId, server.arg("clientid").c_str(), sizeof(g_cfg.clientId));
-  }
-  if (server.hasArg("token")) {
-    strlcpy(g_cfg.token, server.arg("token").c_str(), sizeof(g_cfg.token));
-  }
-  if (server.hasArg("publicid")) {
-    strlcpy(g_cfg.publicId, server.arg("publicid").c_str(), sizeof(g_cfg.publicId));
-  }
-  if (server.hasArg("ssid")) {
-    strlcpy(g_cfg.ssid, server.arg("ssid").c_str(), sizeof(g_cfg.ssid));
-  }
-  if (server.hasArg("pass")) {
-    strlcpy(g_cfg.pass, server.arg("pass").c_str(), sizeof(g_cfg.pass));
-  }
-  
-  g_cfg.confirmed = true;
+  IOT_LOG("[CFG] Probando configuración desde POST");
+  
+  copyArg("clientid", g_cfg.clientId, sizeof(g_cfg.clientId));
+  copyArg("token", g_cfg.token, sizeof(g_cfg.token));
+  copyArg("publicid", g_cfg.publicId, sizeof(g_cfg.publicId));
+  copyArg("ssid", g_cfg.ssid, sizeof(g_cfg.ssid));
+  copyArg("pass", g_cfg.pass, sizeof(g_cfg.pass));
+  
+  // No se confirma ni se guarda hasta que la prueba termine bien
+  g_cfg.confirmed = false;
+  mqttDisconnect();
+  WiFi.disconnect();
+  WiFi.begin(g_cfg.ssid, g_cfg.pass);
+  testState = TestState::Wifi;
+  testStart = millis();
+  
+  sendTemplate(HTML_CONNECTING, g_cfg);
+}
+
+void handleStatus() {
+  static const char* const names[] = {"idle", "wifi", "mqtt", "sync", "done", "error"};
+  char json[160];
+  snprintf(json, sizeof(json), "{\"state\":\"%s\",\"error\":\"%s\"}",
+           names[static_cast<uint8_t>(testState)], testState == TestState::Error ? testError : "");
+  server.send(200, "application/json", json);
+}
+
+static void failTest(const char* reason) {
+  IOT_LOGF("[CFG] Prueba fallida: %s\n", reason);
+  mqttDisconnect();
+  WiFi.disconnect();
+  testError = reason;
+  testState = TestState::Error;
+}
+
+// Avanza la prueba de conexión un paso por llamada
+static void runConnectionTest() {
+  unsigned long now = millis();
   
-  if (saveConfig(g_cfg)) {
-    server.send(200, "text/html", HTML_CONNECTING);
-    Serial.println("[CFG] Configuración guardada, saliendo del portal");
-  } else {
-    server.send(500, "text/plain", "Error guardando configuración");
+  switch (testState) {
+    case TestState::Wifi:
+      if (WiFi.status() == WL_CONNECTED) {
+        IOT_LOGF("[CFG] WiFi OK: %s\n", WiFi.localIP().toString().c_str());
+        testState = TestState::Mqtt;
+      } else if (now - testStart > TEST_WIFI_TIMEOUT_MS) {
+        failTest("No se pudo conectar a la red WiFi. Revisa el nombre y la contraseña.");
+      }
+      break;
+    
+    case TestState::Mqtt:
+      // Bloquea hasta el CONNACK (o el timeout de PubSubClient)
+      mqttBegin();
+      if (mqttConnect(g_cfg)) {
+        testState = TestState::Sync;
+      } else {
+        failTest("El servidor rechazó la conexión. Revisa el Client ID y el Token.");
+      }
+      break;
+    
+    case TestState::Sync: {
+      if (!publishOkSync(g_cfg)) {
+        failTest("No se pudo vincular el dispositivo. Revisa el Public ID.");
+        break;
+      }
+      AppConfig committed = g_cfg;
+      committed.confirmed = true;
+      if (!saveConfig(committed)) {
+        failTest("Error guardando la configuración.");
+        break;
+      }
+      IOT_LOG("[CFG] Configuración verificada y guardada");
+      testState = TestState::Done;
+      testStart = now;
+      break;
+    }
+    
+    case TestState::Done:
+      // Se sale del portal cuando la web ya ha podido ver el resultado
+      if (now - testStart > TEST_DONE_GRACE_MS) g_cfg.confirmed = true;
+      break;
+    
+    default:
+      break;
   }
 }
 
 void handleReset() {
-  Serial.println("[CFG] Reset solicitado desde web");
+  IOT_LOG("[CFG] Reset solicitado desde web");
   clearConfig();
   server.send(200, "text/plain", "Configuración reseteada. Reiniciando...");
   delay(1000);
@@ -353,7 +488,7 @@ void handleCaptivePortal() {
 void startPortal() {
   if (portalActive) return;
   
-  Serial.println("[NET] Iniciando portal cautivo...");
+  IOT_LOG("[NET] Iniciando portal cautivo...");
   
   // Configurar modo AP+STA ANTES de todo
   WiFi.mode(WIFI_AP_STA);
@@ -362,26 +497,15 @@ void startPortal() {
   WiFi.softAPConfig(IPAddress(192, 168, 4, 1), IPAddress(192, 168, 4, 1), IPAddress(255, 255, 255, 0));
   WiFi.softAP(g_apName, "");
   
-  Serial.printf("[NET] AP iniciado: %s en 192.168.4.1\n", g_apName);
+  IOT_LOGF("[NET] AP iniciado: %s en 192.168.4.1\n", g_apName);
   
   // Hacer escaneo inicial de redes ANTES de iniciar el servidor
-  Serial.println("[NET] Escaneo inicial de redes...");
+  IOT_LOG("[NET] Escaneo inicial de redes...");
   int n = WiFi.scanNetworks(false, false, false, 300);
-  Serial.printf("[NET] Escaneo inicial: %d redes encontradas\n", n);
+  IOT_LOGF("[NET] Escaneo inicial: %d redes encontradas\n", n);
   
   // Pre-generar el JSON de redes
-  DynamicJsonDocument doc(4096);
-  JsonArray networks = doc.createNestedArray("networks");
-  if (n > 0) {
-    for (int i = 0; i < n && i < 20; i++) {
-      JsonObject net = networks.createNestedObject();
-      net["ssid"] = WiFi.SSID(i);
-      net["rssi"] = WiFi.RSSI(i);
-      net["enc"] = (WiFi.encryptionType(i) != WIFI_AUTH_OPEN);
-    }
-  }
-  scanResults = "";
-  serializeJson(doc, scanResults);
+  buildScanResults(n);
   lastScanTime = millis();
   WiFi.scanDelete();
   
@@ -392,6 +516,7 @@ void startPortal() {
   server.on("/", HTTP_GET, handleRoot);
   server.on("/scan", HTTP_GET, handleScan);
   server.on("/save", HTTP_POST, handleSave);
+  server.on("/api/status", HTTP_GET, handleStatus);
   server.on("/reset", HTTP_POST, handleReset);
   
   // Rutas para portales cautivos de diferentes sistemas
@@ -404,7 +529,7 @@ void startPortal() {
   // Handler para rutas no encontradas
   server.onNotFound([]() {
     String uri = server.uri();
-    Serial.printf("[NET] Request no encontrado: %s\n", uri.c_str());
+    IOT_LOGF("[NET] Request no encontrado: %s\n", uri.c_str());
     
     // Si es una petición API, devolver error JSON
     if (uri.startsWith("/api")) {
@@ -418,14 +543,15 @@ void startPortal() {
   
   server.begin();
   portalActive = true;
+  testState = TestState::Idle;
   
-  Serial.println("[NET] Portal cautivo activo en http://192.168.4.1/");
+  IOT_LOG("[NET] Portal cautivo activo en http://192.168.4.1/");
 }
 
 void stopPortal() {
   if (!portalActive) return;
   
-  Serial.println("[NET] Deteniendo portal cautivo...");
+  IOT_LOG("[NET] Deteniendo portal cautivo...");
   
   server.stop();
   dnsServer.stop();
@@ -433,7 +559,7 @@ void stopPortal() {
   
   portalActive = false;
   
-  Serial.println("[NET] Portal cautivo detenido");
+  IOT_LOG("[NET] Portal cautivo detenido");
 }
 
 void portalLoop() {
@@ -441,8 +567,15 @@ void portalLoop() {
   
   dnsServer.processNextRequest();
   server.handleClient();
+  runConnectionTest();
 }
 
 bool isPortalActive() {
   return portalActive;
 }
+
+bool portalVerified() {
+  return testState == TestState::Done;
+}
+
+#endif  // IOTCONNECT_NO_PORTAL
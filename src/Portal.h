@@ -1,6 +1,14 @@
 #pragma once
 #include <Arduino.h>
 
+#ifdef IOTCONNECT_NO_PORTAL
+// Portal desactivado en compilación: no se enlaza nada de Portal.cpp
+inline void startPortal() {}
+inline void stopPortal() {}
+inline void portalLoop() {}
+inline bool isPortalActive() { return false; }
+inline bool portalVerified() { return false; }
+#else
 // Funciones del portal cautivo
 void startPortal();
 void stopPortal(); 
@@ -8,3 +16,8 @@ void portalLoop();
 
 // Estado del portal
 bool isPortalActive();
+
+// true si la última configuración se probó desde el portal (WiFi, MQTT y
+// sync correctos): WiFi y MQTT quedan conectados y el sync ya se envió
+bool portalVerified();
+#endif
@@ -0,0 +1,74 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+
+// =============================================================================
+// RingBuffer - Cola circular lock-free de un productor y un consumidor (SPSC)
+// =============================================================================
+// Un único task escribe con push()/back() y un único task lee con pop()/front().
+// No usa mutex ni memoria dinámica: las posiciones de lectura y escritura son
+// atómicas y cada una la modifica un solo lado, así que ambas operaciones son
+// wait-free. N debe ser potencia de 2.
+// =============================================================================
+
+template <typename T, size_t N>
+class RingBuffer {
+  static_assert(N >= 2 && (N & (N - 1)) == 0, "N debe ser potencia de 2");
+
+public:
+  // Productor: copia el elemento. false si la cola está llena.
+  bool push(const T& item) {
+    T* slot = back();
+    if (!slot) return false;
+    *slot = item;
+    commit();
+    return true;
+  }
+
+  // Productor: hueco libre para escribir el elemento en su sitio (nullptr si
+  // está llena). El consumidor no lo ve hasta commit().
+  T* back() {
+    size_t head = _head.load(std::memory_order_relaxed);
+    if (head - _tail.load(std::memory_order_acquire) >= N) return nullptr;
+    return &_items[head & (N - 1)];
+  }
+
+  // Productor: publica el elemento escrito en back()
+  void commit() {
+    _head.store(_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  // Consumidor: copia y retira el elemento más antiguo. false si está vacía.
+  bool pop(T& item) {
+    T* next = front();
+    if (!next) return false;
+    item = *next;
+    drop();
+    return true;
+  }
+
+  // Consumidor: acceso sin copia al elemento más antiguo (nullptr si vacía).
+  // El elemento sigue siendo válido hasta llamar a drop().
+  T* front() {
+    size_t tail = _tail.load(std::memory_order_relaxed);
+    if (tail == _head.load(std::memory_order_acquire)) return nullptr;
+    return &_items[tail & (N - 1)];
+  }
+
+  // Consumidor: retira el elemento devuelto por front()
+  void drop() {
+    _tail.store(_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  size_t size() const {
+    return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+  }
+
+  bool empty() const { return size() == 0; }
+  static constexpr size_t capacity() { return N; }
+
+private:
+  T _items[N];
+  std::atomic<size_t> _head{0};
+  std::atomic<size_t> _tail{0};
+};
@@ -0,0 +1,166 @@
+#include "Rpc.h"
+
+#ifndef IOTCONNECT_NO_RPC
+
+#include "Log.h"
+#include "MqttClient.h"
+#include "Outbox.h"
+#include <utility>
+
+struct RpcMethod {
+  char name[RPC_METHOD_MAX];
+  RpcHandler handler;
+};
+
+struct RpcPending {
+  bool used;
+  uint16_t id;
+  unsigned long deadline;
+  RpcCallback callback;
+};
+
+static constexpr uint8_t OUTBOX_CRITICAL = 0;
+
+static char prefix[MQTT_TOPIC_MAX];   // <publicId>/rpc/
+static size_t prefixLen = 0;
+
+static RpcMethod methods[RPC_METHODS];
+static size_t methodCount = 0;
+static RpcPending pending[RPC_PENDING];
+static uint16_t nextId = 1;
+
+static bool send(const char* kind, const char* method, const char* payload) {
+  static MqttMessage msg;  // Solo desde el task de la app
+  char topic[MQTT_TOPIC_MAX];
+  int len = method ? snprintf(topic, sizeof(topic), "%s%s/%s", prefix, kind, method)
+                   : snprintf(topic, sizeof(topic), "%s%s", prefix, kind);
+  if (len < 0 || (size_t)len >= sizeof(topic)) return false;
+  if (!fillMqttMessage(msg, topic, payload)) return false;
+  return outboxPush(OUTBOX_CRITICAL, msg);
+}
+
+void rpcBegin(const char* publicId, bool (*subscribe)(const char* topic, uint8_t qos)) {
+  int len = snprintf(prefix, sizeof(prefix), "%s/rpc/", publicId);
+  if (len < 0 || (size_t)len >= sizeof(prefix)) return;
+  prefixLen = len;
+
+  char filter[MQTT_TOPIC_MAX];
+  snprintf(filter, sizeof(filter), "%sreq/+", prefix);
+  subscribe(filter, 1);
+  snprintf(filter, sizeof(filter), "%sret", prefix);
+  subscribe(filter, 1);
+}
+
+bool rpcOn(const char* method, RpcHandler handler) {
+  for (size_t i = 0; i < methodCount; i++) {
+    if (strcmp(methods[i].name, method) == 0) {
+      methods[i].handler = handler;
+      return true;
+    }
+  }
+  if (methodCount >= RPC_METHODS || strlen(method) >= RPC_METHOD_MAX) {
+    IOT_LOGF("[RPC] No se puede registrar %s\n", method);
+    return false;
+  }
+  strlcpy(methods[methodCount].name, method, RPC_METHOD_MAX);
+  methods[methodCount].handler = handler;
+  methodCount++;
+  return true;
+}
+
+bool rpcCall(const char* method, const char* args, uint32_t timeoutMs, RpcCallback callback) {
+  if (prefixLen == 0) return false;
+
+  RpcPending* slot = nullptr;
+  for (auto& p : pending) {
+    if (!p.used) { slot = &p; break; }
+  }
+  if (!slot) {
+    IOT_LOGF("[RPC] Sin huecos para %s (%d pendientes)\n", method, (int)RPC_PENDING);
+    return false;
+  }
+
+  uint16_t id = nextId++;
+  if (nextId == 0) nextId = 1;
+
+  static char payload[MQTT_PAYLOAD_MAX + 1];
+  int len = snprintf(payload, sizeof(payload), "%u|%s", id, args);
+  if (len < 0 || (size_t)len >= sizeof(payload) || !send("call", method, payload)) return false;
+
+  slot->used = true;
+  slot->id = id;
+  slot->deadline = millis() + timeoutMs;
+  slot->callback = callback;
+  return true;
+}
+
+// p/rpc/req/<método>: ejecutar el handler y responder con el mismo id
+static void handleRequest(const char* method, const char* payload) {
+  const char* bar = strchr(payload, '|');
+  size_t idLen = bar ? bar - payload : strlen(payload);
+  const char* args = bar ? bar + 1 : "";
+
+  static char result[MQTT_PAYLOAD_MAX / 2];
+  result[0] = '\0';
+  int code = RPC_UNKNOWN_METHOD;
+  for (size_t i = 0; i < methodCount; i++) {
+    if (strcmp(methods[i].name, method) == 0) {
+      code = methods[i].handler(args, result, sizeof(result));
+      break;
+    }
+  }
+  if (code == RPC_UNKNOWN_METHOD) IOT_LOGF("[RPC] Método desconocido: %s\n", method);
+
+  static char reply[MQTT_PAYLOAD_MAX + 1];
+  int len = snprintf(reply, sizeof(reply), "%.*s|%d|%s", (int)idLen, payload, code, result);
+  if (len < 0 || (size_t)len >= sizeof(reply) || !send("res", method, reply)) {
+    IOT_LOGF("[RPC] No se pudo responder a %s\n", method);
+  }
+}
+
+// p/rpc/ret: respuesta a una llamada nuestra
+static void handleReturn(const char* payload) {
+  char* end;
+  unsigned long id = strtoul(payload, &end, 10);
+  if (*end != '|') return;
+  int code = strtol(end + 1, &end, 10);
+  const char* result = *end == '|' ? end + 1 : "";
+
+  for (auto& p : pending) {
+    if (!p.used || p.id != id) continue;
+    p.used = false;  // Antes de llamar: el callback puede hacer otra llamada
+    RpcCallback callback = std::move(p.callback);
+    p.callback = nullptr;
+    if (callback) callback(code, result);
+    return;
+  }
+  // Ya vencida o repetida: se ignora
+}
+
+bool rpcHandle(const char* topic, const char* payload) {
+  if (prefixLen == 0 || strncmp(topic, prefix, prefixLen) != 0) return false;
+  const char* rest = topic + prefixLen;
+
+  if (strncmp(rest, "req/", 4) == 0) {
+    handleRequest(rest + 4, payload);
+    return true;
+  }
+  if (strcmp(rest, "ret") == 0) {
+    handleReturn(payload);
+    return true;
+  }
+  return false;
+}
+
+void rpcSweep() {
+  unsigned long now = millis();
+  for (auto& p : pending) {
+    if (!p.used || (long)(now - p.deadline) < 0) continue;
+    p.used = false;
+    RpcCallback callback = std::move(p.callback);
+    p.callback = nullptr;
+    if (callback) callback(RPC_TIMEOUT, "");
+  }
+}
+
+#endif  // IOTCONNECT_NO_RPC
@@ -0,0 +1,66 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include "Config.h"
+#ifdef IOTCONNECT_STATIC_ALLOC
+#include "StaticCallback.h"
+#endif
+
+// =============================================================================
+// Rpc - Peticiones y respuestas sobre MQTT con identificador de correlación
+// =============================================================================
+// MQTT 3.1.1 no tiene correlation data: el identificador va al principio
+// del payload, separado por '|'. Topics (p = publicId):
+//
+//   Servidor -> dispositivo (métodos registrados con rpcOn)
+//     p/rpc/req/<método>   "<id>|<argumentos>"
+//     p/rpc/res/<método>   "<id>|<código>|<resultado>"   (respuesta)
+//
+//   Dispositivo -> servidor (rpcCall)
+//     p/rpc/call/<método>  "<id>|<argumentos>"
+//     p/rpc/ret            "<id>|<código>|<resultado>"   (respuesta)
+//
+// Todo se ejecuta en el task de la app: los handlers y callbacks se llaman
+// desde IoTConnect.loop() y las respuestas salen por la cola Critical.
+// =============================================================================
+
+// Códigos de respuesta propios (los handlers pueden devolver cualquier otro)
+constexpr int RPC_OK = 0;
+constexpr int RPC_TIMEOUT = -1;          // Sin respuesta antes del plazo
+constexpr int RPC_UNKNOWN_METHOD = -2;   // Método no registrado
+constexpr int RPC_NOT_SENT = -3;         // No se pudo encolar la petición
+
+#ifdef IOTCONNECT_STATIC_ALLOC
+using RpcHandler = StaticCallback<int(const char* args, char* result, size_t resultSize)>;
+using RpcCallback = StaticCallback<void(int code, const char* result)>;
+#else
+// Atiende una petición: escribe el resultado en result y devuelve el código
+using RpcHandler = std::function<int(const char* args, char* result, size_t resultSize)>;
+
+// Respuesta a rpcCall (code = RPC_TIMEOUT si no llegó a tiempo)
+using RpcCallback = std::function<void(int code, const char* result)>;
+#endif
+
+#ifdef IOTCONNECT_NO_RPC
+// RPC desactivado en compilación: no se enlaza nada de Rpc.cpp
+inline void rpcBegin(const char*, bool (*)(const char*, uint8_t)) {}
+inline bool rpcOn(const char*, RpcHandler) { return false; }
+inline bool rpcCall(const char*, const char*, uint32_t, RpcCallback) { return false; }
+inline bool rpcHandle(const char*, const char*) { return false; }
+inline void rpcSweep() {}
+#else
+// Prepara los topics y se suscribe con subscribe (una vez conocido publicId)
+void rpcBegin(const char* publicId, bool (*subscribe)(const char* topic, uint8_t qos));
+
+bool rpcOn(const char* method, RpcHandler handler);
+
+// Encola la petición. false si la tabla de pendientes está llena o no
+// se pudo encolar; en ese caso no se llamará a callback.
+bool rpcCall(const char* method, const char* args, uint32_t timeoutMs, RpcCallback callback);
+
+// Procesa un mensaje recibido. true si era de RPC.
+bool rpcHandle(const char* topic, const char* payload);
+
+// Vence las peticiones sin respuesta (llamar en cada loop)
+void rpcSweep();
+#endif
@@ -0,0 +1,313 @@
+#include "Shadow.h"
+
+#ifndef IOTCONNECT_NO_SHADOW
+
+#include "Log.h"
+#include "MqttClient.h"
+#include "Outbox.h"
+#include <ArduinoJson.h>
+#include <Preferences.h>
+#include <atomic>
+
+struct ShadowEntry {
+  char key[SHADOW_KEY_MAX];
+  char reported[SHADOW_VALUE_MAX];
+  char desired[SHADOW_VALUE_MAX];
+  bool hasReported;
+  bool hasDesired;
+  bool dirty;       // Reportado y aún sin publicar
+};
+
+static constexpr uint8_t OUTBOX_NORMAL = 1;
+static const char* NAMESPACE = "iotshadow";
+// Una ráfaga de cambios se guarda (y publica completa) una vez al final
+static constexpr unsigned long SHADOW_SETTLE_MS = 10000;
+
+static Preferences prefs;
+static ShadowEntry entries[SHADOW_KEYS];
+static size_t entryCount = 0;
+static uint32_t version = 0;
+static bool loaded = false;
+static bool needSave = false;
+static bool wasConnected = false;
+static bool fullRequested = false;
+static bool fullStale = false;    // Cambió algo desde el último "reported"
+static unsigned long lastChange = 0;
+static std::atomic<bool> clearRequested{false};
+static bool applying = false;     // Dentro de handleDesired (usa doc)
+static ShadowCallback desiredCallback = nullptr;
+
+static char prefix[MQTT_TOPIC_MAX];   // <publicId>/shadow/
+static size_t prefixLen = 0;
+
+// Entrada y salida de JSON: solo desde el task de la app
+static StaticJsonDocument<JSON_DOC_SIZE> doc;
+
+static void load() {
+  if (loaded) return;
+  loaded = true;
+  if (!prefs.begin(NAMESPACE, true)) return;  // Aún no hay nada guardado
+
+  version = prefs.getUInt("version", 0);
+  size_t size = prefs.getBytesLength("entries");
+  if (size % sizeof(ShadowEntry) == 0 && size <= sizeof(entries)) {
+    prefs.getBytes("entries", entries, size);
+    entryCount = size / sizeof(ShadowEntry);
+  } else if (size > 0) {
+    IOT_LOG("[SHD] Estado guardado incompatible, se descarta");
+  }
+  prefs.end();
+  IOT_LOGF("[SHD] %d claves cargadas (versión %lu)\n", (int)entryCount, (unsigned long)version);
+}
+
+static void markChanged() {
+  needSave = true;
+  lastChange = millis();
+}
+
+static void save() {
+  if (!prefs.begin(NAMESPACE, false)) {
+    IOT_LOG("[SHD] Error abriendo NVS para escritura");
+    return;
+  }
+  prefs.putUInt("version", version);
+  prefs.putBytes("entries", entries, entryCount * sizeof(ShadowEntry));
+  prefs.end();
+  needSave = false;
+}
+
+static ShadowEntry* find(const char* key) {
+  for (size_t i = 0; i < entryCount; i++) {
+    if (strcmp(entries[i].key, key) == 0) return &entries[i];
+  }
+  return nullptr;
+}
+
+static ShadowEntry* findOrAdd(const char* key) {
+  ShadowEntry* entry = find(key);
+  if (entry) return entry;
+  if (entryCount >= SHADOW_KEYS || strlen(key) >= SHADOW_KEY_MAX) {
+    IOT_LOGF("[SHD] No cabe la clave %s\n", key);
+    return nullptr;
+  }
+  entry = &entries[entryCount++];
+  memset(entry, 0, sizeof(*entry));
+  strlcpy(entry->key, key, sizeof(entry->key));
+  return entry;
+}
+
+static bool publish(const char* kind, const char* payload, bool retained) {
+  static MqttMessage msg;
+  char topic[MQTT_TOPIC_MAX];
+  int len = snprintf(topic, sizeof(topic), "%s%s", prefix, kind);
+  if (len < 0 || (size_t)len >= sizeof(topic)) return false;
+  if (!fillMqttMessage(msg, topic, payload, retained)) return false;
+  return outboxPush(OUTBOX_NORMAL, msg);
+}
+
+// Arma {"v":<versión>,...} con las claves que quepan en un mensaje.
+// Las cadenas no se copian: el documento apunta a entries.
+static size_t buildDocument(bool onlyDirty, uint32_t v, bool* included) {
+  doc.clear();
+  doc["v"] = v;
+  size_t count = 0;
+  for (size_t i = 0; i < entryCount; i++) {
+    included[i] = false;
+    const ShadowEntry& e = entries[i];
+    if (!e.hasReported || (onlyDirty && !e.dirty)) continue;
+    doc[e.key] = (const char*)e.reported;
+    if (doc.overflowed() || measureJson(doc) > MQTT_PAYLOAD_MAX) {
+      doc.remove(e.key);  // El resto va en el siguiente delta
+      break;
+    }
+    included[i] = true;
+    count++;
+  }
+  return count;
+}
+
+static bool publishDocument(const char* kind, bool onlyDirty, uint32_t v, bool* included) {
+  static char payload[MQTT_PAYLOAD_MAX + 1];
+  if (buildDocument(onlyDirty, v, included) == 0 && onlyDirty) return false;
+  serializeJson(doc, payload, sizeof(payload));
+  return publish(kind, payload, !onlyDirty);
+}
+
+static void publishDelta() {
+  bool included[SHADOW_KEYS];
+  if (!publishDocument("delta", true, version + 1, included)) return;  // Se reintenta
+
+  version++;
+  for (size_t i = 0; i < entryCount; i++) {
+    if (included[i]) entries[i].dirty = false;
+  }
+  fullStale = true;
+  markChanged();
+}
+
+static void publishVersion() {
+  char payload[12];
+  snprintf(payload, sizeof(payload), "%lu", (unsigned long)version);
+  publish("version", payload, true);
+}
+
+static void handleDesired(char* payload, size_t length) {
+  DeserializationError err = deserializeJson(doc, payload, length);
+  if (err) {
+    IOT_LOGF("[SHD] desired no válido: %s\n", err.c_str());
+    return;
+  }
+
+  char value[SHADOW_VALUE_MAX];
+  applying = true;
+  for (JsonPair kv : doc.as<JsonObject>()) {
+    // Los números y booleanos se guardan como texto
+    JsonVariant v = kv.value();
+    if (v.is<const char*>()) {
+      if (strlcpy(value, v.as<const char*>(), sizeof(value)) >= sizeof(value)) continue;
+    } else if (serializeJson(v, value, sizeof(value)) >= sizeof(value) - 1) {
+      continue;
+    }
+
+    ShadowEntry* entry = findOrAdd(kv.key().c_str());
+    if (!entry) continue;
+    if (!entry->hasDesired || strcmp(entry->desired, value) != 0) {
+      strlcpy(entry->desired, value, sizeof(entry->desired));
+      entry->hasDesired = true;
+      markChanged();
+    }
+    bool differs = !entry->hasReported || strcmp(entry->reported, value) != 0;
+    if (differs && desiredCallback) desiredCallback(entry->key, entry->desired);
+  }
+  applying = false;
+}
+
+void shadowBegin(const char* publicId, bool (*subscribe)(const char* topic, uint8_t qos)) {
+  load();
+  int len = snprintf(prefix, sizeof(prefix), "%s/shadow/", publicId);
+  if (len < 0 || (size_t)len >= sizeof(prefix)) return;
+  prefixLen = len;
+
+  char filter[MQTT_TOPIC_MAX];
+  snprintf(filter, sizeof(filter), "%sdesired", prefix);
+  subscribe(filter, 1);
+  snprintf(filter, sizeof(filter), "%sget", prefix);
+  subscribe(filter, 1);
+}
+
+bool shadowSet(const char* key, const char* value) {
+  load();
+  if (strlen(value) >= SHADOW_VALUE_MAX) {
+    IOT_LOGF("[SHD] Valor demasiado largo para %s\n", key);
+    return false;
+  }
+  ShadowEntry* entry = findOrAdd(key);
+  if (!entry) return false;
+  if (entry->hasReported && strcmp(entry->reported, value) == 0) return true;
+
+  strlcpy(entry->reported, value, sizeof(entry->reported));
+  entry->hasReported = true;
+  entry->dirty = true;
+  markChanged();
+  return true;
+}
+
+const char* shadowGet(const char* key) {
+  load();
+  ShadowEntry* entry = find(key);
+  return entry && entry->hasReported ? entry->reported : nullptr;
+}
+
+const char* shadowGetDesired(const char* key) {
+  load();
+  ShadowEntry* entry = find(key);
+  return entry && entry->hasDesired ? entry->desired : nullptr;
+}
+
+void shadowOnDesired(ShadowCallback callback) {
+  desiredCallback = callback;
+}
+
+uint32_t shadowVersion() {
+  load();
+  return version;
+}
+
+bool shadowHandle(const char* topic, char* payload, size_t length) {
+  if (prefixLen == 0 || strncmp(topic, prefix, prefixLen) != 0) return false;
+  const char* kind = topic + prefixLen;
+
+  if (strcmp(kind, "desired") == 0) {
+    handleDesired(payload, length);
+    return true;
+  }
+  if (strcmp(kind, "get") == 0) {
+    fullRequested = true;
+    return true;
+  }
+  return false;
+}
+
+static void clearLocal() {
+  entryCount = 0;
+  version = 0;
+  needSave = false;
+  fullStale = false;
+  fullRequested = false;
+  loaded = true;
+}
+
+void shadowService(bool connected) {
+  if (clearRequested.exchange(false)) {
+    // save() pudo escribir mientras se borraba: se borra de nuevo aquí
+    if (prefs.begin(NAMESPACE, false)) {
+      prefs.clear();
+      prefs.end();
+    }
+    clearLocal();
+    IOT_LOG("[SHD] Estado borrado");
+  }
+
+  bool reconnected = connected && !wasConnected;
+  wasConnected = connected;
+  bool settled = millis() - lastChange >= SHADOW_SETTLE_MS;
+
+  if (connected && prefixLen > 0 && !applying) {
+    bool pending = false;
+    for (size_t i = 0; i < entryCount; i++) pending |= entries[i].dirty;
+
+    if (pending) {
+      publishDelta();
+    } else if (reconnected) {
+      publishVersion();
+    }
+    // El completo retenido se rehace cuando los cambios se calman
+    if (fullRequested || (fullStale && settled && !pending)) {
+      bool included[SHADOW_KEYS];
+      if (publishDocument("reported", false, version, included)) {
+        fullRequested = false;
+        fullStale = false;
+      }
+    }
+  }
+
+  // La flash se desgasta: se escribe cuando los cambios se calman
+  if (needSave && settled) save();
+}
+
+void shadowFlush() {
+  if (needSave) save();
+}
+
+void shadowClear() {
+  // NVS admite accesos desde varios tasks; la copia en memoria es del task
+  // de la app y la borra shadowService()
+  Preferences nvs;
+  if (nvs.begin(NAMESPACE, false)) {
+    nvs.clear();
+    nvs.end();
+  }
+  clearRequested = true;
+}
+
+#endif  // IOTCONNECT_NO_SHADOW
@@ -0,0 +1,81 @@
+#pragma once
+#include <Arduino.h>
+#include <functional>
+#include "Config.h"
+#ifdef IOTCONNECT_STATIC_ALLOC
+#include "StaticCallback.h"
+#endif
+
+// =============================================================================
+// Shadow - Estado del dispositivo (clave/valor) en memoria y en NVS
+// =============================================================================
+// "reported" es lo que el dispositivo dice tener; "desired" lo que pide la
+// nube. Solo se publica lo que cambia. Topics (p = publicId):
+//
+//   Dispositivo -> servidor
+//     p/shadow/delta      {"v":<versión>,"clave":"valor",...}  Claves cambiadas
+//     p/shadow/version    "<versión>"           (retenido) Tras reconectar
+//     p/shadow/reported   {"v":<versión>,...}   (retenido) Estado completo,
+//                                                 al calmarse los cambios
+//
+//   Servidor -> dispositivo
+//     p/shadow/desired    {"clave":valor,...}   (retenido por el servidor)
+//     p/shadow/get                              Pide el estado completo
+//
+// Los cambios de un mismo loop() salen juntos en un delta y la versión sube
+// con cada delta. Al reconectar sin cambios solo se envía la versión: si el
+// servidor tiene otra (se perdió un delta), pide el estado con p/shadow/get.
+// Los cambios hechos sin conexión se conservan (también tras reiniciar) y
+// salen en el primer delta. Se guardan en NVS cuando llevan SHADOW_SETTLE_MS
+// sin cambiar (o con shadowFlush()): un corte en ese intervalo pierde los
+// últimos, que el servidor ya tiene por los deltas.
+// =============================================================================
+
+#ifdef IOTCONNECT_STATIC_ALLOC
+using ShadowCallback = StaticCallback<void(const char* key, const char* value)>;
+#else
+// Un valor deseado distinto del reportado
+using ShadowCallback = std::function<void(const char* key, const char* value)>;
+#endif
+
+#ifdef IOTCONNECT_NO_SHADOW
+// Shadow desactivado en compilación: no se enlaza nada de Shadow.cpp
+inline void shadowBegin(const char*, bool (*)(const char*, uint8_t)) {}
+inline bool shadowSet(const char*, const char*) { return false; }
+inline const char* shadowGet(const char*) { return nullptr; }
+inline const char* shadowGetDesired(const char*) { return nullptr; }
+inline void shadowOnDesired(ShadowCallback) {}
+inline uint32_t shadowVersion() { return 0; }
+inline bool shadowHandle(const char*, char*, size_t) { return false; }
+inline void shadowService(bool) {}
+inline void shadowFlush() {}
+inline void shadowClear() {}
+#else
+// Prepara los topics y se suscribe con subscribe (una vez conocido publicId)
+void shadowBegin(const char* publicId, bool (*subscribe)(const char* topic, uint8_t qos));
+
+// Cambia un valor reportado. false si no caben más claves o el valor es largo.
+bool shadowSet(const char* key, const char* value);
+
+// Valores guardados (nullptr si la clave no existe)
+const char* shadowGet(const char* key);
+const char* shadowGetDesired(const char* key);
+
+void shadowOnDesired(ShadowCallback callback);
+uint32_t shadowVersion();
+
+// Procesa un mensaje recibido. true si era del shadow. Interpreta el JSON
+// sobre el propio payload, que queda modificado.
+bool shadowHandle(const char* topic, char* payload, size_t length);
+
+// Publica el delta pendiente y guarda en NVS (llamar en cada loop, desde el
+// task de la app)
+void shadowService(bool connected);
+
+// Guarda ya lo pendiente (antes de dormir o reiniciar; task de la app)
+void shadowFlush();
+
+// Borra el estado guardado (reset de configuración). Desde cualquier task:
+// la copia en memoria se borra en el siguiente shadowService().
+void shadowClear();
+#endif
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstddef>
+#include <type_traits>
+
+// =============================================================================
+// StaticCallback - Referencia a función que nunca reserva memoria
+// =============================================================================
+// Sustituye a std::function en el modo IOTCONNECT_STATIC_ALLOC. Admite
+// funciones libres, lambdas sin captura, o una función que recibe un
+// contexto (void*) más ese contexto:
+//
+//   IoTConnect.onMessage(onMessage);
+//   IoTConnect.onMessage({[](void* ctx, const char* t, const char* p) {
+//     static_cast<Sensor*>(ctx)->handle(t, p);
+//   }, &sensor});
+// =============================================================================
+
+template <typename Signature>
+class StaticCallback;
+
+template <typename R, typename... Args>
+class StaticCallback<R(Args...)> {
+public:
+  using Function = R (*)(Args...);
+  using ContextFunction = R (*)(void* context, Args...);
+
+  StaticCallback() = default;
+  StaticCallback(std::nullptr_t) {}
+  StaticCallback(Function fn) : _fn(fn) {}
+  StaticCallback(ContextFunction fn, void* context) : _contextFn(fn), _context(context) {}
+
+  // Lambdas sin captura (convertibles a puntero a función)
+  template <typename F,
+            typename = typename std::enable_if<std::is_convertible<F, Function>::value>::type>
+  StaticCallback(F fn) : _fn(static_cast<Function>(fn)) {}
+
+  explicit operator bool() const { return _fn || _contextFn; }
+
+  R operator()(Args... args) const {
+    if (_contextFn) return _contextFn(_context, args...);
+    return _fn(args...);
+  }
+
+private:
+  Function _fn = nullptr;
+  ContextFunction _contextFn = nullptr;
+  void* _context = nullptr;
+};
@@ -0,0 +1,163 @@
+#include "Telemetry.h"
+#include "Log.h"
+#include "Config.h"
+#include "MqttClient.h"
+#include "Outbox.h"
+
+struct WindowStats {
+  float min;
+  float max;
+  float sum;
+  float last;
+  uint32_t count;
+};
+
+struct TelemetryChannel {
+  char topic[MQTT_TOPIC_MAX];
+  uint32_t windowMs;
+  uint16_t maxSamples;
+  TelemetryEncoding encoding;
+  float resolution;
+
+  WindowStats current;        // Ventana en curso
+  unsigned long windowStart;  // Primera muestra de la ventana
+  WindowStats pending;        // Cerrada y aún sin publicar
+
+  // Último registro enviado, para Delta (min, max, media, último)
+  int32_t previous[4];
+  uint8_t sinceKeyframe;
+  bool needKeyframe;
+};
+
+static constexpr uint8_t OUTBOX_BULK = 2;
+
+static TelemetryChannel channels[TELEMETRY_CHANNELS];
+static size_t channelCount = 0;
+static bool wasConnected = false;
+static uint32_t merged = 0;
+
+static void mergeStats(WindowStats& into, const WindowStats& from) {
+  if (into.count == 0) {
+    into = from;
+    return;
+  }
+  if (from.min < into.min) into.min = from.min;
+  if (from.max > into.max) into.max = from.max;
+  into.sum += from.sum;
+  into.last = from.last;
+  into.count += from.count;
+}
+
+static void closeWindow(TelemetryChannel& ch) {
+  if (ch.current.count == 0) return;
+  if (ch.pending.count > 0) merged++;
+  mergeStats(ch.pending, ch.current);
+  ch.current.count = 0;
+}
+
+static bool formatRecord(TelemetryChannel& ch, char* out, size_t size) {
+  const WindowStats& s = ch.pending;
+  float mean = s.sum / s.count;
+  int len;
+
+  if (ch.encoding == TelemetryEncoding::Json) {
+    len = snprintf(out, size, "{\"n\":%u,\"min\":%g,\"max\":%g,\"mean\":%g,\"last\":%g}",
+                   (unsigned)s.count, s.min, s.max, mean, s.last);
+    return len > 0 && (size_t)len < size;
+  }
+
+  int32_t values[4] = {
+    (int32_t)lroundf(s.min / ch.resolution),
+    (int32_t)lroundf(s.max / ch.resolution),
+    (int32_t)lroundf(mean / ch.resolution),
+    (int32_t)lroundf(s.last / ch.resolution),
+  };
+  bool keyframe = ch.needKeyframe || ch.sinceKeyframe >= TELEMETRY_KEYFRAME;
+  int32_t out4[4];
+  for (int i = 0; i < 4; i++) out4[i] = keyframe ? values[i] : values[i] - ch.previous[i];
+
+  len = snprintf(out, size, "%c,%u,%ld,%ld,%ld,%ld", keyframe ? 'a' : 'd', (unsigned)s.count,
+                 (long)out4[0], (long)out4[1], (long)out4[2], (long)out4[3]);
+  if (len <= 0 || (size_t)len >= size) return false;
+
+  // Si el Outbox lo rechaza, el siguiente intento sale como absoluto
+  memcpy(ch.previous, values, sizeof(values));
+  ch.sinceKeyframe = keyframe ? 1 : ch.sinceKeyframe + 1;
+  ch.needKeyframe = false;
+  return true;
+}
+
+int telemetryAddChannel(const char* topic, uint32_t windowMs, uint16_t maxSamples,
+                        TelemetryEncoding encoding, float resolution) {
+  if (channelCount >= TELEMETRY_CHANNELS) {
+    IOT_LOGF("[TLM] Sin huecos para canales (%d)\n", (int)TELEMETRY_CHANNELS);
+    return -1;
+  }
+  if ((windowMs == 0 && maxSamples == 0) || resolution <= 0) return -1;
+
+  TelemetryChannel& ch = channels[channelCount];
+  if (strlcpy(ch.topic, topic, sizeof(ch.topic)) >= sizeof(ch.topic)) return -1;
+  ch.windowMs = windowMs;
+  ch.maxSamples = maxSamples;
+  ch.encoding = encoding;
+  ch.resolution = resolution;
+  ch.current.count = 0;
+  ch.pending.count = 0;
+  ch.needKeyframe = true;
+  ch.sinceKeyframe = 0;
+  IOT_LOGF("[TLM] Canal %d: %s (%lu ms / %u muestras)\n", (int)channelCount, topic,
+           (unsigned long)windowMs, maxSamples);
+  return channelCount++;
+}
+
+bool telemetryRecord(int channel, float value) {
+  if (channel < 0 || (size_t)channel >= channelCount) return false;
+  TelemetryChannel& ch = channels[channel];
+  WindowStats& s = ch.current;
+
+  if (s.count == 0) {
+    ch.windowStart = millis();
+    s.min = s.max = s.sum = value;
+  } else {
+    if (value < s.min) s.min = value;
+    if (value > s.max) s.max = value;
+    s.sum += value;
+  }
+  s.last = value;
+  s.count++;
+
+  if (ch.maxSamples && s.count >= ch.maxSamples) closeWindow(ch);
+  return true;
+}
+
+void telemetryService(bool connected) {
+  // Al reconectar se envía también la ventana a medias
+  bool reconnected = connected && !wasConnected;
+  wasConnected = connected;
+  unsigned long now = millis();
+
+  for (size_t i = 0; i < channelCount; i++) {
+    TelemetryChannel& ch = channels[i];
+    if (ch.current.count > 0 &&
+        (reconnected || (ch.windowMs && now - ch.windowStart >= ch.windowMs))) {
+      closeWindow(ch);
+    }
+    if (reconnected) ch.needKeyframe = true;
+    if (!connected || ch.pending.count == 0) continue;
+
+    static MqttMessage msg;
+    char payload[96];
+    if (!formatRecord(ch, payload, sizeof(payload))) continue;
+    if (!fillMqttMessage(msg, ch.topic, payload)) continue;
+    if (!outboxPush(OUTBOX_BULK, msg)) {
+      // Cola llena: se conserva y se reintenta como absoluto
+      ch.needKeyframe = true;
+      continue;
+    }
+    ch.pending.count = 0;
+  }
+}
+
+uint32_t telemetryMergedCount() {
+  return merged;
+}
@@ -0,0 +1,38 @@
+#pragma once
+#include <Arduino.h>
+
+// =============================================================================
+// Telemetry - Agregación por ventanas de canales numéricos
+// =============================================================================
+// En lugar de publicar cada muestra, cada canal acumula min/max/media/último/
+// número de muestras en memoria constante y publica un único registro al
+// cerrarse la ventana (por tiempo, por número de muestras o lo que llegue
+// antes). Sin conexión las ventanas cerradas se funden en un registro
+// pendiente que se envía, junto con la ventana en curso, al reconectar.
+//
+// telemetryRecord() y telemetryService() se llaman desde el mismo task (el
+// de la app, dentro de IoTConnect.loop()); los registros salen por la cola
+// Bulk del Outbox.
+// =============================================================================
+
+// Formato del registro publicado
+enum class TelemetryEncoding : uint8_t {
+  Json,   // {"n":12,"min":20.1,"max":21.3,"mean":20.7,"last":21}
+  Delta   // "a,n,min,max,mean,last" en unidades de resolution; después
+          // "d,n,..." como diferencia con el registro anterior. Se repite
+          // el absoluto tras reconectar y cada TELEMETRY_KEYFRAME registros
+};
+
+// Alta de un canal. windowMs = 0 o maxSamples = 0 desactivan ese límite
+// (al menos uno debe estar activo). Devuelve el índice o -1.
+int telemetryAddChannel(const char* topic, uint32_t windowMs, uint16_t maxSamples,
+                        TelemetryEncoding encoding, float resolution);
+
+// Añade una muestra al canal (O(1), sin reservar memoria)
+bool telemetryRecord(int channel, float value);
+
+// Cierra ventanas vencidas y publica lo pendiente si connected
+void telemetryService(bool connected);
+
+// Ventanas cerradas que se fundieron con otra sin llegar a publicarse
+uint32_t telemetryMergedCount();
@@ -0,0 +1,56 @@
+#include "Trace.h"
+
+#ifdef IOTCONNECT_TRACE
+#include "Config.h"
+#include <atomic>
+
+struct TraceEvent {
+  const char* name;
+  uint32_t start;
+  uint32_t duration;
+  uint8_t core;
+};
+
+static TraceEvent events[TRACE_EVENTS];
+static_assert((TRACE_EVENTS & (TRACE_EVENTS - 1)) == 0, "TRACE_EVENTS debe ser potencia de 2");
+
+static std::atomic<uint32_t> nextEvent{0};   // Total grabado (no se reinicia al dar la vuelta)
+static std::atomic<bool> paused{false};
+
+void traceRecord(const char* name, uint32_t startUs, uint32_t durationUs) {
+  if (paused.load(std::memory_order_relaxed)) return;
+  uint32_t index = nextEvent.fetch_add(1, std::memory_order_relaxed) % TRACE_EVENTS;
+  TraceEvent& e = events[index];
+  e.name = name;
+  e.start = startUs;
+  e.duration = durationUs;
+  e.core = xPortGetCoreID();
+}
+
+size_t traceDump(Print& out) {
+  uint32_t total = nextEvent.load(std::memory_order_relaxed);
+  uint32_t count = total < TRACE_EVENTS ? total : TRACE_EVENTS;
+  uint32_t first = total - count;   // Los más antiguos que siguen en el buffer
+
+  char line[128];
+  size_t written = out.print("{\"traceEvents\":[");
+  for (uint32_t i = 0; i < count; i++) {
+    const TraceEvent& e = events[(first + i) % TRACE_EVENTS];
+    int len = snprintf(line, sizeof(line),
+                       "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%lu,\"pid\":1,\"tid\":%u}",
+                       i ? "," : "", e.name, (unsigned long)e.start, (unsigned long)e.duration, e.core);
+    if (len > 0) written += out.write(reinterpret_cast<const uint8_t*>(line), strnlen(line, sizeof(line) - 1));
+  }
+  written += out.print("],\"displayTimeUnit\":\"ms\"}");
+  return written;
+}
+
+void traceClear() {
+  nextEvent.store(0, std::memory_order_relaxed);
+}
+
+void traceSetPaused(bool pause) {
+  paused.store(pause, std::memory_order_relaxed);
+}
+
+#endif  // IOTCONNECT_TRACE
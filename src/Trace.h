@@ -0,0 +1,45 @@
+#pragma once
+#include <Arduino.h>
+
+// =============================================================================
+// Trace - Tramos de tiempo en un buffer circular fijo
+// =============================================================================
+// Con -DIOTCONNECT_TRACE, IOT_TRACE("nombre") mide desde ese punto hasta el
+// final del bloque y lo guarda (nombre, inicio y duración en µs, núcleo).
+// Sin la opción la macro no genera código.
+//
+// traceDump() escribe el contenido en formato trace_event de Chrome, listo
+// para abrir en chrome://tracing o ui.perfetto.dev. Los nombres deben ser
+// literales: se guarda el puntero, no una copia.
+// =============================================================================
+
+#ifdef IOTCONNECT_TRACE
+
+void traceRecord(const char* name, uint32_t startUs, uint32_t durationUs);
+
+// Escribe el JSON en out (Serial, un Print que cuente bytes...). Devuelve
+// los bytes escritos. Si se graba a la vez, algún tramo puede salir mezclado.
+size_t traceDump(Print& out);
+
+void traceClear();
+
+// En pausa no se graba nada (para volcar una instantánea estable)
+void traceSetPaused(bool paused);
+
+class TraceScope {
+public:
+  explicit TraceScope(const char* name) : _name(name), _start(micros()) {}
+  ~TraceScope() { traceRecord(_name, _start, micros() - _start); }
+
+private:
+  const char* _name;
+  uint32_t _start;
+};
+
+#define IOT_TRACE_JOIN_(a, b) a##b
+#define IOT_TRACE_JOIN(a, b)  IOT_TRACE_JOIN_(a, b)
+#define IOT_TRACE(name) TraceScope IOT_TRACE_JOIN(traceScope_, __LINE__)(name)
+
+#else
+#define IOT_TRACE(name) do {} while (0)
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+// Lo mínimo del core de Arduino para compilar módulos sin hardware en el host.
+// millis(), delay() y micros() (solo si se usa) los define cada prueba
+// (reloj simulado).
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <cmath>
+
+typedef uint8_t byte;
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// Un solo núcleo
+inline int xPortGetCoreID() { return 0; }
+
+inline size_t strlcpy(char* dst, const char* src, size_t size) {
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+
+class IPAddress {};
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size) {
+    size_t n = 0;
+    while (size--) n += write(*buf++);
+    return n;
+  }
+  size_t print(const char* text) { return write(reinterpret_cast<const uint8_t*>(text), strlen(text)); }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+class Client : public Stream {
+public:
+  virtual int connect(IPAddress ip, uint16_t port) = 0;
+  virtual int connect(const char* host, uint16_t port) = 0;
+  virtual int connect(IPAddress ip, uint16_t port, int32_t timeout) = 0;
+  virtual int connect(const char* host, uint16_t port, int32_t timeout) = 0;
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buf, size_t size) = 0;
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int read(uint8_t* buf, size_t size) = 0;
+  virtual int peek() = 0;
+  virtual void flush() = 0;
+  virtual void stop() = 0;
+  virtual uint8_t connected() = 0;
+  virtual operator bool() = 0;
+};
@@ -0,0 +1,389 @@
+#pragma once
+#include <Arduino.h>
+#include <WiFi.h>
+
+// =============================================================================
+// FakeBroker - Broker MQTT 3.1.1 en el mismo proceso, con fallos a demanda
+// =============================================================================
+// Hace de red y de broker para los WiFiClient (WiFiClient::network). Cada
+// enlace es una conexión TCP con un tubo por sentido; cada byte lleva la hora
+// a la que llega al otro lado, así la latencia y las retransmisiones salen
+// del reloj simulado de la prueba. El broker atiende CONNECT, SUBSCRIBE,
+// UNSUBSCRIBE, PUBLISH (QoS 0), PINGREQ y DISCONNECT.
+//
+// Fallos (todos sobre el reloj simulado):
+//   setLatency(ms)       Retardo de cada sentido
+//   setLoss(percent)     Segmentos perdidos: TCP los retransmite, así que
+//                        llegan tarde (200 ms o más), no faltan
+//   halfOpen()           El enlace deja de pasar datos sin que el cliente lo
+//                        sepa (NAT caducado, AP que se cae sin avisar)
+//   stall(ms)            El broker no lee ni responde durante ms y luego
+//                        sigue con lo acumulado
+//   reset()              RST: el cliente ve la conexión cerrada y lo que
+//                        estaba en vuelo se pierde
+//   restart(downMs)      Reinicio del broker: RST en todos los enlaces, sin
+//                        sesiones y rechazando conexiones durante downMs
+//   refuseConnack(code, count)  Las próximas count conexiones reciben
+//                        CONNACK con ese código y se cierran
+//
+// Sin heap: todo son arrays fijos.
+// =============================================================================
+
+class FakeBroker : public FakeNetwork {
+public:
+  using PublishHook = void (*)(void* context, const char* topic, const uint8_t* payload, size_t length);
+
+  static constexpr size_t LINKS = 4;
+  static constexpr size_t PIPE_BYTES = 16384;   // Buffer TCP por sentido
+  static constexpr size_t SUBS = 16;
+  static constexpr size_t TOPIC_MAX = 128;
+  static constexpr size_t PACKET_MAX = 4096;
+
+  FakeBroker() { WiFiClient::network = this; }
+  ~FakeBroker() { WiFiClient::network = nullptr; }
+
+  // Cada PUBLISH que llega al broker (lo que el dispositivo consiguió enviar)
+  void onPublish(PublishHook hook, void* context) {
+    _hook = hook;
+    _hookContext = context;
+  }
+
+  void setLatency(unsigned long ms) { _latency = ms; }
+  void setLoss(unsigned percent) { _lossPercent = percent; }
+
+  void halfOpen() {
+    for (auto& link : _links) {
+      if (link.open) link.halfOpen = true;
+    }
+  }
+
+  void stall(unsigned long ms) { _stallUntil = millis() + ms; }
+
+  void reset() {
+    for (auto& link : _links) {
+      if (link.open && !link.halfOpen) link.reset = true;
+    }
+  }
+
+  void restart(unsigned long downMs) {
+    for (auto& link : _links) {
+      if (link.open) link.reset = true;
+    }
+    _downUntil = millis() + downMs;
+  }
+
+  void refuseConnack(uint8_t code, unsigned count) {
+    _refuseCode = code;
+    _refuseCount = count;
+  }
+
+  // Publica desde el "servidor" a los suscritos
+  void publish(const char* topic, const char* payload) {
+    service();
+    unsigned long when = millis();
+    if ((long)(when - _stallUntil) < 0) when = _stallUntil;   // Parado: sale al volver
+    route(topic, (const uint8_t*)payload, strlen(payload), when);
+  }
+
+  // Enlaces con la sesión MQTT aceptada
+  size_t sessions() const {
+    size_t count = 0;
+    for (auto& link : _links) {
+      if (link.open && link.connected && !link.reset && !link.halfOpen) count++;
+    }
+    return count;
+  }
+
+  // --- FakeNetwork (lo usa WiFiClient) ---
+
+  int open(const char*, uint16_t) override {
+    delay(2 * _latency);  // SYN / SYN-ACK
+    if ((long)(millis() - _downUntil) < 0) return -1;  // Connection refused
+    for (size_t i = 0; i < LINKS; i++) {
+      Link& link = _links[i];
+      if (link.open) continue;
+      link.clear();
+      link.open = true;
+      return i;
+    }
+    return -1;
+  }
+
+  size_t send(int id, const uint8_t* buf, size_t size) override {
+    service();
+    Link& link = _links[id];
+    if (link.reset || link.closing) return 0;
+    if (link.halfOpen) return size;   // Al vacío, sin error
+    return link.up.push(buf, size, arrival());
+  }
+
+  int available(int id) override {
+    service();
+    Link& link = _links[id];
+    if (link.reset || link.halfOpen) return 0;
+    return link.down.ready(millis());
+  }
+
+  int read(int id) override {
+    if (available(id) <= 0) return -1;
+    return _links[id].down.pop();
+  }
+
+  int peek(int id) override {
+    if (available(id) <= 0) return -1;
+    return _links[id].down.front();
+  }
+
+  bool alive(int id) override {
+    service();
+    Link& link = _links[id];
+    if (link.reset) return false;
+    // Cerrado por el broker: el cliente aún puede leer lo que quedaba
+    return !link.closing || link.down.ready(millis()) > 0;
+  }
+
+  void close(int id) override {
+    _links[id].open = false;
+  }
+
+private:
+  // Bytes en vuelo por un sentido, cada uno con su hora de llegada
+  struct Pipe {
+    uint8_t data[PIPE_BYTES];
+    unsigned long at[PIPE_BYTES];
+    size_t head = 0;
+    size_t tail = 0;
+    unsigned long last = 0;   // Llegada del último byte (TCP entrega en orden)
+
+    size_t size() const { return head - tail; }
+    size_t push(const uint8_t* buf, size_t size, unsigned long when) {
+      if (this->size() > 0 && (long)(last - when) > 0) when = last;
+      size_t n = 0;
+      while (n < size && this->size() < PIPE_BYTES) {
+        data[head % PIPE_BYTES] = buf[n++];
+        at[head % PIPE_BYTES] = when;
+        head++;
+      }
+      last = when;
+      return n;
+    }
+    int ready(unsigned long now) const {
+      size_t n = 0;
+      while (tail + n < head && (long)(now - at[(tail + n) % PIPE_BYTES]) >= 0) n++;
+      return n;
+    }
+    uint8_t front() const { return data[tail % PIPE_BYTES]; }
+    unsigned long frontAt() const { return at[tail % PIPE_BYTES]; }
+    uint8_t pop() { return data[tail++ % PIPE_BYTES]; }
+  };
+
+  struct Link {
+    bool open = false;
+    bool connected = false;   // CONNECT aceptado
+    bool halfOpen = false;
+    bool reset = false;
+    bool closing = false;     // El broker cerró tras enviar lo pendiente
+    Pipe up;                  // Cliente -> broker
+    Pipe down;                // Broker -> cliente
+    uint8_t packet[PACKET_MAX];
+    size_t packetLen = 0;
+    char subs[SUBS][TOPIC_MAX];
+    size_t subCount = 0;
+
+    void clear() {
+      open = connected = halfOpen = reset = closing = false;
+      up.head = up.tail = down.head = down.tail = 0;
+      packetLen = subCount = 0;
+    }
+  };
+
+  Link _links[LINKS];
+  PublishHook _hook = nullptr;
+  void* _hookContext = nullptr;
+  unsigned long _latency = 0;
+  unsigned _lossPercent = 0;
+  uint32_t _lossSeed = 12345;
+  unsigned long _stallUntil = 0;
+  unsigned long _downUntil = 0;
+  uint8_t _refuseCode = 0;
+  unsigned _refuseCount = 0;
+
+  // Hora de llegada de un segmento enviado ahora: latencia, más las
+  // retransmisiones si se pierde (Pipe::push mantiene el orden)
+  unsigned long arrival() {
+    unsigned long when = millis() + _latency;
+    unsigned long rto = 200;
+    while (_lossPercent && nextRandom() % 100 < _lossPercent) {
+      when += rto;
+      rto *= 2;
+    }
+    return when;
+  }
+
+  uint32_t nextRandom() {
+    _lossSeed = _lossSeed * 1103515245 + 12345;
+    return _lossSeed >> 16;
+  }
+
+  // Procesa lo que ya ha llegado al broker. Las respuestas salen a la hora
+  // de llegada del paquete, no a la de esta llamada.
+  void service() {
+    unsigned long now = millis();
+    if ((long)(now - _stallUntil) < 0) return;
+    for (auto& link : _links) {
+      if (!link.open || link.reset || link.halfOpen || link.closing) continue;
+      while (link.up.ready(now) > 0) {
+        unsigned long when = link.up.frontAt();
+        if ((long)(when - _stallUntil) < 0) when = _stallUntil;
+        if (link.packetLen < PACKET_MAX) link.packet[link.packetLen] = link.up.pop();
+        else link.up.pop();
+        link.packetLen++;
+        size_t total;
+        if (packetComplete(link, total)) {
+          handlePacket(link, total, when);
+          link.packetLen = 0;
+          if (link.closing) break;
+        }
+      }
+    }
+  }
+
+  static bool packetComplete(const Link& link, size_t& total) {
+    if (link.packetLen < 2) return false;
+    size_t length = 0;
+    size_t multiplier = 1;
+    size_t pos = 1;
+    while (true) {
+      if (pos >= link.packetLen) return false;
+      uint8_t digit = link.packet[pos++];
+      length += (digit & 127) * multiplier;
+      multiplier *= 128;
+      if (!(digit & 128)) break;
+    }
+    total = pos + length;
+    return link.packetLen >= total;
+  }
+
+  void reply(Link& link, const uint8_t* data, size_t size, unsigned long when) {
+    link.down.push(data, size, when + _latency);
+  }
+
+  static size_t readString(const uint8_t* p, char* out, size_t max) {
+    size_t len = (p[0] << 8) | p[1];
+    size_t n = len < max - 1 ? len : max - 1;
+    memcpy(out, p + 2, n);
+    out[n] = '\0';
+    return 2 + len;
+  }
+
+  void handlePacket(Link& link, size_t total, unsigned long when) {
+    if (total > PACKET_MAX) return;   // No cabe: se ignora
+    uint8_t type = link.packet[0] & 0xF0;
+    size_t pos = 1;
+    while (link.packet[pos] & 0x80) pos++;
+    pos++;
+    const uint8_t* body = link.packet + pos;
+    size_t bodyLen = total - pos;
+
+    switch (type) {
+      case 0x10: {  // CONNECT
+        uint8_t code = 0;
+        if (_refuseCount > 0) {
+          _refuseCount--;
+          code = _refuseCode;
+        }
+        const uint8_t connack[4] = {0x20, 0x02, 0x00, code};
+        reply(link, connack, sizeof(connack), when);
+        link.connected = code == 0;
+        link.closing = code != 0;
+        break;
+      }
+      case 0x80: {  // SUBSCRIBE
+        uint8_t suback[4 + SUBS] = {0x90, 0, body[0], body[1]};
+        size_t count = 0;
+        for (size_t p = 2; p < bodyLen && count < SUBS;) {
+          char filter[TOPIC_MAX];
+          p += readString(body + p, filter, sizeof(filter));
+          uint8_t qos = body[p++];
+          addSubscription(link, filter);
+          suback[4 + count++] = qos;
+        }
+        suback[1] = 2 + count;
+        reply(link, suback, 4 + count, when);
+        break;
+      }
+      case 0xA0: {  // UNSUBSCRIBE
+        char filter[TOPIC_MAX];
+        readString(body + 2, filter, sizeof(filter));
+        for (size_t i = 0; i < link.subCount; i++) {
+          if (strcmp(link.subs[i], filter) == 0) strcpy(link.subs[i], link.subs[--link.subCount]);
+        }
+        const uint8_t unsuback[4] = {0xB0, 0x02, body[0], body[1]};
+        reply(link, unsuback, sizeof(unsuback), when);
+        break;
+      }
+      case 0x30: {  // PUBLISH (QoS 0)
+        char topic[TOPIC_MAX];
+        size_t used = readString(body, topic, sizeof(topic));
+        if (_hook) _hook(_hookContext, topic, body + used, bodyLen - used);
+        route(topic, body + used, bodyLen - used, when);
+        break;
+      }
+      case 0xC0: {  // PINGREQ
+        const uint8_t pingresp[2] = {0xD0, 0x00};
+        reply(link, pingresp, sizeof(pingresp), when);
+        break;
+      }
+      case 0xE0:    // DISCONNECT
+        link.closing = true;
+        break;
+    }
+  }
+
+  void addSubscription(Link& link, const char* filter) {
+    for (size_t i = 0; i < link.subCount; i++) {
+      if (strcmp(link.subs[i], filter) == 0) return;
+    }
+    if (link.subCount < SUBS) strcpy(link.subs[link.subCount++], filter);
+  }
+
+  static bool matches(const char* filter, const char* topic) {
+    while (*filter) {
+      if (*filter == '#') return true;
+      if (*filter == '+') {
+        while (*topic && *topic != '/') topic++;
+        filter++;
+        continue;
+      }
+      if (*filter++ != *topic++) return false;
+    }
+    return !*topic;
+  }
+
+  void route(const char* topic, const uint8_t* payload, size_t length, unsigned long when) {
+    for (auto& link : _links) {
+      if (!link.open || !link.connected || link.reset || link.closing) continue;
+      bool subscribed = false;
+      for (size_t i = 0; i < link.subCount && !subscribed; i++) subscribed = matches(link.subs[i], topic);
+      if (!subscribed || link.halfOpen) continue;   // Medio abierto: se pierde
+
+      size_t topicLen = strlen(topic);
+      size_t remaining = 2 + topicLen + length;
+      uint8_t header[5] = {0x30};
+      size_t headerLen = 1;
+      do {
+        uint8_t digit = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) digit |= 0x80;
+        header[headerLen++] = digit;
+      } while (remaining > 0);
+      const uint8_t lengthBytes[2] = {(uint8_t)(topicLen >> 8), (uint8_t)(topicLen & 0xFF)};
+      unsigned long at = arrival();
+      if ((long)(when + _latency - at) > 0) at = when + _latency;
+      link.down.push(header, headerLen, at);
+      link.down.push(lengthBytes, 2, at);
+      link.down.push((const uint8_t*)topic, topicLen, at);
+      link.down.push(payload, length, at);
+    }
+  }
+};
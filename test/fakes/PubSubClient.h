@@ -0,0 +1,325 @@
+#pragma once
+#include <Arduino.h>
+
+// Lo que usa la librería de PubSubClient 2.8, con su mismo comportamiento
+// (QoS 0 al publicar, keepalive, estados y esperas) sobre un Client
+// cualquiera. El buffer es fijo, sin heap. Las esperas de lectura llaman a
+// delay(1): en el host el reloj solo avanza así.
+
+#define MQTT_CONNECTION_TIMEOUT     -4
+#define MQTT_CONNECTION_LOST        -3
+#define MQTT_CONNECT_FAILED         -2
+#define MQTT_DISCONNECTED           -1
+#define MQTT_CONNECTED               0
+
+class PubSubClient : public Print {
+public:
+  static constexpr size_t BUFFER_MAX = 4096;
+  using Callback = void (*)(char* topic, uint8_t* payload, unsigned int length);
+
+  explicit PubSubClient(Client& client) : _client(&client) {}
+
+  bool setBufferSize(uint16_t size) {
+    if (size == 0 || size > BUFFER_MAX) return false;
+    _bufferSize = size;
+    return true;
+  }
+  PubSubClient& setServer(const char* domain, uint16_t port) {
+    _domain = domain;
+    _port = port;
+    return *this;
+  }
+  PubSubClient& setCallback(Callback callback) {
+    _callback = callback;
+    return *this;
+  }
+  PubSubClient& setKeepAlive(uint16_t keepAlive) {
+    _keepAlive = keepAlive;
+    return *this;
+  }
+  PubSubClient& setSocketTimeout(uint16_t timeout) {
+    _socketTimeout = timeout;
+    return *this;
+  }
+
+  bool connect(const char* id, const char* user, const char* pass, const char* willTopic,
+               uint8_t willQos, bool willRetain, const char* willMessage, bool cleanSession) {
+    if (connected()) return true;
+    if (!_client->connect(_domain, _port)) {
+      _state = MQTT_CONNECT_FAILED;
+      return false;
+    }
+    _nextMsgId = 1;
+
+    static const uint8_t header[7] = {0x00, 0x04, 'M', 'Q', 'T', 'T', 4};
+    size_t pos = HEADER_MAX;
+    memcpy(_buffer + pos, header, sizeof(header));
+    pos += sizeof(header);
+    uint8_t flags = cleanSession ? 0x02 : 0x00;
+    if (willTopic) flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+    if (user) flags |= 0x80;
+    if (pass) flags |= 0x40;
+    _buffer[pos++] = flags;
+    _buffer[pos++] = _keepAlive >> 8;
+    _buffer[pos++] = _keepAlive & 0xFF;
+    pos = writeString(id, pos);
+    if (willTopic) {
+      pos = writeString(willTopic, pos);
+      pos = writeString(willMessage, pos);
+    }
+    if (user) pos = writeString(user, pos);
+    if (pass) pos = writeString(pass, pos);
+    if (!writePacket(0x10, pos - HEADER_MAX)) {
+      _client->stop();
+      _state = MQTT_CONNECT_FAILED;
+      return false;
+    }
+
+    _lastInActivity = _lastOutActivity = millis();
+    while (!_client->available()) {
+      if (millis() - _lastInActivity >= _socketTimeout * 1000UL) {
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        return false;
+      }
+      delay(1);
+    }
+    size_t len = readPacket();
+    if (len == 4) {
+      if (_buffer[3] == 0) {
+        _lastInActivity = millis();
+        _pingOutstanding = false;
+        _state = MQTT_CONNECTED;
+        return true;
+      }
+      _state = _buffer[3];
+    }
+    _client->stop();
+    return false;
+  }
+
+  bool connected() {
+    if (!_client->connected()) {
+      if (_state == MQTT_CONNECTED) {
+        _state = MQTT_CONNECTION_LOST;
+        _client->flush();
+        _client->stop();
+      }
+      return false;
+    }
+    return _state == MQTT_CONNECTED;
+  }
+
+  void disconnect() {
+    _buffer[0] = 0xE0;
+    _buffer[1] = 0;
+    _client->write(_buffer, 2);
+    _state = MQTT_DISCONNECTED;
+    _client->flush();
+    _client->stop();
+    _lastInActivity = _lastOutActivity = millis();
+  }
+
+  bool loop() {
+    if (!connected()) return false;
+    unsigned long t = millis();
+    unsigned long keepAliveMs = _keepAlive * 1000UL;
+    if (t - _lastInActivity > keepAliveMs || t - _lastOutActivity > keepAliveMs) {
+      if (_pingOutstanding) {
+        _state = MQTT_CONNECTION_TIMEOUT;
+        _client->stop();
+        return false;
+      }
+      _buffer[0] = 0xC0;
+      _buffer[1] = 0;
+      _client->write(_buffer, 2);
+      _lastOutActivity = _lastInActivity = t;
+      _pingOutstanding = true;
+    }
+    if (_client->available()) {
+      size_t len = readPacket();
+      if (len > 0) {
+        _lastInActivity = t;
+        uint8_t type = _buffer[0] & 0xF0;
+        if (type == 0x30) {
+          deliver(len);
+        } else if (type == 0xC0) {
+          _buffer[0] = 0xD0;
+          _buffer[1] = 0;
+          _client->write(_buffer, 2);
+        } else if (type == 0xD0) {
+          _pingOutstanding = false;
+        }
+      } else if (!connected()) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  bool publish(const char* topic, const char* payload, bool retained = false) {
+    return publish(topic, (const uint8_t*)payload, payload ? strlen(payload) : 0, retained);
+  }
+  bool publish(const char* topic, const uint8_t* payload, unsigned int length, bool retained) {
+    if (!connected()) return false;
+    if (_bufferSize < HEADER_MAX + 2 + strlen(topic) + length) return false;
+    size_t pos = writeString(topic, HEADER_MAX);
+    memcpy(_buffer + pos, payload, length);
+    pos += length;
+    return writePacket(0x30 | (retained ? 1 : 0), pos - HEADER_MAX);
+  }
+
+  bool beginPublish(const char* topic, unsigned int length, bool retained) {
+    if (!connected()) return false;
+    size_t topicLen = strlen(topic);
+    uint8_t header[HEADER_MAX];
+    size_t headerLen = encodeHeader(header, 0x30 | (retained ? 1 : 0), 2 + topicLen + length);
+    size_t written = _client->write(header, headerLen);
+    uint8_t lengthBytes[2] = {(uint8_t)(topicLen >> 8), (uint8_t)(topicLen & 0xFF)};
+    written += _client->write(lengthBytes, 2);
+    written += _client->write((const uint8_t*)topic, topicLen);
+    _lastOutActivity = millis();
+    return written == headerLen + 2 + topicLen;
+  }
+  int endPublish() { return 1; }
+
+  size_t write(uint8_t b) override {
+    _lastOutActivity = millis();
+    return _client->write(b);
+  }
+  size_t write(const uint8_t* buf, size_t size) override {
+    _lastOutActivity = millis();
+    return _client->write(buf, size);
+  }
+
+  bool subscribe(const char* topic, uint8_t qos = 0) {
+    if (qos > 1 || !connected()) return false;
+    size_t pos = HEADER_MAX;
+    pos = writeMsgId(pos);
+    pos = writeString(topic, pos);
+    _buffer[pos++] = qos;
+    return writePacket(0x82, pos - HEADER_MAX);
+  }
+  bool unsubscribe(const char* topic) {
+    if (!connected()) return false;
+    size_t pos = writeMsgId(HEADER_MAX);
+    pos = writeString(topic, pos);
+    return writePacket(0xA2, pos - HEADER_MAX);
+  }
+
+  int state() { return _state; }
+
+private:
+  static constexpr size_t HEADER_MAX = 5;
+
+  Client* _client;
+  const char* _domain = "";
+  uint16_t _port = 0;
+  Callback _callback = nullptr;
+  uint16_t _keepAlive = 15;
+  uint16_t _socketTimeout = 15;
+  uint16_t _bufferSize = 256;
+  uint8_t _buffer[BUFFER_MAX];
+  uint16_t _nextMsgId = 1;
+  unsigned long _lastInActivity = 0;
+  unsigned long _lastOutActivity = 0;
+  bool _pingOutstanding = false;
+  int _state = MQTT_DISCONNECTED;
+
+  static size_t encodeHeader(uint8_t* out, uint8_t type, size_t length) {
+    size_t pos = 0;
+    out[pos++] = type;
+    do {
+      uint8_t digit = length % 128;
+      length /= 128;
+      if (length > 0) digit |= 0x80;
+      out[pos++] = digit;
+    } while (length > 0);
+    return pos;
+  }
+
+  size_t writeString(const char* text, size_t pos) {
+    size_t len = strlen(text);
+    _buffer[pos++] = len >> 8;
+    _buffer[pos++] = len & 0xFF;
+    memcpy(_buffer + pos, text, len);
+    return pos + len;
+  }
+
+  size_t writeMsgId(size_t pos) {
+    if (++_nextMsgId == 0) _nextMsgId = 1;
+    _buffer[pos++] = _nextMsgId >> 8;
+    _buffer[pos++] = _nextMsgId & 0xFF;
+    return pos;
+  }
+
+  // Cabecera fija justo delante del cuerpo, que empieza en HEADER_MAX
+  bool writePacket(uint8_t type, size_t length) {
+    uint8_t header[HEADER_MAX];
+    size_t headerLen = encodeHeader(header, type, length);
+    uint8_t* start = _buffer + HEADER_MAX - headerLen;
+    memcpy(start, header, headerLen);
+    size_t written = _client->write(start, headerLen + length);
+    _lastOutActivity = millis();
+    return written == headerLen + length;
+  }
+
+  bool readByte(uint8_t* out) {
+    unsigned long start = millis();
+    while (!_client->available()) {
+      if (millis() - start >= _socketTimeout * 1000UL) return false;
+      delay(1);
+    }
+    *out = _client->read();
+    return true;
+  }
+
+  // Paquete completo en _buffer; 0 si no llega a tiempo o no cabe
+  size_t readPacket() {
+    size_t len = 0;
+    if (!readByte(&_buffer[len++])) return 0;
+    uint32_t length = 0;
+    uint32_t multiplier = 1;
+    uint8_t digit;
+    do {
+      if (len == 5) {
+        _state = MQTT_DISCONNECTED;
+        _client->stop();
+        return 0;
+      }
+      if (!readByte(&digit)) return 0;
+      _buffer[len++] = digit;
+      length += (digit & 127) * multiplier;
+      multiplier *= 128;
+    } while (digit & 128);
+    for (uint32_t i = 0; i < length; i++) {
+      if (!readByte(&digit)) return 0;
+      if (len < _bufferSize) _buffer[len] = digit;
+      len++;
+    }
+    if (len > _bufferSize) return 0;
+    return len;
+  }
+
+  // Como PubSubClient: el topic se mueve un byte para terminarlo en '\0'
+  void deliver(size_t len) {
+    if (!_callback) return;
+    size_t llen = 1;
+    while (_buffer[llen] & 0x80) llen++;
+    uint16_t topicLen = (_buffer[llen + 1] << 8) + _buffer[llen + 2];
+    memmove(_buffer + llen + 2, _buffer + llen + 3, topicLen);
+    _buffer[llen + 2 + topicLen] = 0;
+    char* topic = (char*)_buffer + llen + 2;
+    if ((_buffer[0] & 0x06) == 0x02) {
+      uint16_t msgId = (_buffer[llen + 3 + topicLen] << 8) + _buffer[llen + 3 + topicLen + 1];
+      uint8_t* payload = _buffer + llen + 3 + topicLen + 2;
+      _callback(topic, payload, len - llen - 3 - topicLen - 2);
+      uint8_t puback[4] = {0x40, 0x02, (uint8_t)(msgId >> 8), (uint8_t)(msgId & 0xFF)};
+      _client->write(puback, 4);
+      _lastOutActivity = millis();
+    } else {
+      uint8_t* payload = _buffer + llen + 3 + topicLen;
+      _callback(topic, payload, len - llen - 3 - topicLen);
+    }
+  }
+};
@@ -0,0 +1,52 @@
+#pragma once
+#include <Arduino.h>
+
+// Red simulada a la que se conectan los WiFiClient (ver FakeBroker.h). Sin
+// red instalada, connect() falla como si no hubiera WiFi.
+class FakeNetwork {
+public:
+  virtual ~FakeNetwork() {}
+  virtual int open(const char* host, uint16_t port) = 0;   // Id del enlace o -1
+  virtual size_t send(int link, const uint8_t* buf, size_t size) = 0;
+  virtual int available(int link) = 0;
+  virtual int read(int link) = 0;
+  virtual int peek(int link) = 0;
+  virtual bool alive(int link) = 0;
+  virtual void close(int link) = 0;
+};
+
+class WiFiClient : public Client {
+public:
+  static inline FakeNetwork* network = nullptr;
+
+  int connect(IPAddress, uint16_t port) override { return connect("", port); }
+  int connect(const char* host, uint16_t port) override {
+    stop();
+    if (network) _link = network->open(host, port);
+    return _link >= 0;
+  }
+  int connect(IPAddress ip, uint16_t port, int32_t) override { return connect(ip, port); }
+  int connect(const char* host, uint16_t port, int32_t) override { return connect(host, port); }
+  size_t write(uint8_t b) override { return write(&b, 1); }
+  size_t write(const uint8_t* buf, size_t size) override {
+    return _link >= 0 ? network->send(_link, buf, size) : 0;
+  }
+  int available() override { return _link >= 0 ? network->available(_link) : 0; }
+  int read() override { return _link >= 0 ? network->read(_link) : -1; }
+  int read(uint8_t* buf, size_t size) override {
+    size_t n = 0;
+    while (n < size && available() > 0) buf[n++] = read();
+    return n ? (int)n : -1;
+  }
+  int peek() override { return _link >= 0 ? network->peek(_link) : -1; }
+  void flush() override {}
+  void stop() override {
+    if (_link >= 0) network->close(_link);
+    _link = -1;
+  }
+  uint8_t connected() override { return _link >= 0 && network->alive(_link); }
+  operator bool() override { return connected(); }
+
+private:
+  int _link = -1;
+};
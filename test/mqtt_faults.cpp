@@ -0,0 +1,274 @@
+// Fallos de red contra la conexión MQTT de la librería (host). MqttClient,
+// MqttTap y Outbox se compilan tal cual sobre fakes/: PubSubClient hace lo
+// mismo que la 2.8 y FakeBroker hace de red y de broker e inyecta latencia,
+// pérdidas, enlaces medio abiertos, paradas, RST, reinicios y CONNACK de
+// error. Todo corre sobre un reloj simulado.
+//
+// El dispositivo hace lo mismo que IoTConnect.loop() sin task de red:
+// reconecta cada 5 s, estabiliza 1 s antes de darse por conectado, sirve el
+// Outbox y duerme 100 ms. Publica telemetría cada 200 ms (rechazada, como
+// publish(), si no está listo) y el servidor le manda un comando cada 500 ms.
+//
+// Cada escenario se repite con el fallo en distintos momentos y se informa
+// del tiempo hasta detectar la caída, del tiempo hasta volver a estar listo
+// y de los mensajes perdidos en cada sentido: aceptados por la librería que
+// no llegaron al broker y comandos publicados que no llegaron a la app.
+#include "../src/MqttClient.h"
+#include "../src/Outbox.h"
+#include "FakeBroker.h"
+#include <algorithm>
+#include <cstdlib>
+#include <vector>
+
+static unsigned long now = 0;
+unsigned long millis() { return now; }
+void delay(unsigned long ms) { now += ms; }
+
+static constexpr unsigned long LATENCY_MS = 20;
+static constexpr unsigned long TICK_MS = 100;        // delay() de loop()
+static constexpr unsigned long RETRY_MS = 5000;      // Como handleNormalOperation()
+static constexpr unsigned long SEND_EVERY_MS = 200;
+static constexpr unsigned long CMD_EVERY_MS = 500;
+static constexpr unsigned long WARMUP_MS = 20000;
+static constexpr unsigned long SETTLE_MS = 20000;    // Tras volver, antes de contar
+static constexpr unsigned long GIVE_UP_MS = 120000;
+static constexpr int RUNS = 8;
+
+static const char* const TELEMETRY_TOPIC = "pub/tlm";
+static const char* const COMMAND_TOPIC = "pub/cmd";
+
+static FakeBroker broker;
+static AppConfig cfg = {"ssid", "pass", "dev1", "token", "pub", true};
+
+// Números de secuencia vistos en cada sentido durante una pasada
+static std::vector<bool> atBroker;
+static std::vector<bool> atDevice;
+
+static void countSeq(std::vector<bool>& seen, const uint8_t* payload, size_t length) {
+  char text[16];
+  if (length >= sizeof(text)) return;
+  memcpy(text, payload, length);
+  text[length] = '\0';
+  size_t seq = strtoul(text, nullptr, 10);
+  if (seq < seen.size()) seen[seq] = true;
+}
+
+static void onBrokerPublish(void*, const char* topic, const uint8_t* payload, size_t length) {
+  if (strcmp(topic, TELEMETRY_TOPIC) == 0) countSeq(atBroker, payload, length);
+}
+
+static void onDeviceMessage(const char* topic, const uint8_t* payload, unsigned int length) {
+  if (strcmp(topic, COMMAND_TOPIC) == 0) countSeq(atDevice, payload, length);
+}
+
+// Lo que hacen handleNormalOperation() y loop() con la WiFi arriba
+struct Device {
+  bool wasConnected = false;
+  unsigned long lastRetry = 0;
+  int failCount = 0;
+  int worstFailCount = 0;
+
+  bool ready() { return wasConnected && isMqttConnected() && isMqttStable(); }
+
+  void tick() {
+    if (isMqttConnected()) {
+      mqttLoop();
+      failCount = 0;
+      if (!wasConnected) {
+        for (int i = 0; i < 20 && isMqttConnected(); i++) {
+          mqttLoop();
+          delay(50);
+        }
+        wasConnected = isMqttConnected();
+      }
+    } else {
+      wasConnected = false;
+      if (now - lastRetry > RETRY_MS) {
+        lastRetry = now;
+        if (!mqttConnect(cfg)) worstFailCount = std::max(worstFailCount, ++failCount);
+      }
+    }
+    outboxService(OUTBOX_BURST);
+    delay(TICK_MS);
+  }
+};
+
+static Device device;
+
+struct Scenario {
+  const char* name;
+  void (*inject)();
+  void (*clear)();
+};
+
+static void noClear() {}
+
+static const Scenario scenarios[] = {
+  {"latencia 300 ms", [] { broker.setLatency(300); }, [] { broker.setLatency(LATENCY_MS); }},
+  {"pérdida 5 %", [] { broker.setLoss(5); }, [] { broker.setLoss(0); }},
+  {"medio abierto", [] { broker.halfOpen(); }, noClear},
+  {"broker parado 3 s", [] { broker.stall(3000); }, noClear},
+  {"broker parado 12 s", [] { broker.stall(12000); }, noClear},
+  {"RST", [] { broker.reset(); }, noClear},
+  {"reinicio broker 10 s", [] { broker.restart(10000); }, noClear},
+  {"RST + 2 CONNACK 3", [] { broker.refuseConnack(3, 2); broker.reset(); }, noClear},
+};
+
+struct RunResult {
+  bool dropped;             // La librería vio la caída
+  bool recovered;
+  unsigned long detectMs;   // Fallo -> conexión dada por perdida
+  unsigned long readyMs;    // Fallo -> lista otra vez
+  size_t outSent, outLost, outRejected;
+  size_t inSent, inLost;
+  int failCount;
+};
+
+static RunResult runOnce(const Scenario& scenario, unsigned long phaseMs) {
+  RunResult r = {};
+  const size_t maxSeq = (WARMUP_MS + GIVE_UP_MS + SETTLE_MS) / std::min(SEND_EVERY_MS, CMD_EVERY_MS) + 16;
+  atBroker.assign(maxSeq, false);
+  atDevice.assign(maxSeq, false);
+  std::vector<bool> accepted(maxSeq, false);
+  size_t outSeq = 0, inSeq = 0;
+  unsigned long nextSend = now, nextCmd = now;
+  device.worstFailCount = 0;
+
+  auto traffic = [&]() {
+    char text[16];
+    while ((long)(now - nextSend) >= 0 && outSeq < maxSeq) {
+      nextSend += SEND_EVERY_MS;
+      if (!device.ready()) {
+        r.outRejected++;
+        outSeq++;
+        continue;
+      }
+      MqttMessage msg;
+      snprintf(text, sizeof(text), "%zu", outSeq);
+      fillMqttMessage(msg, TELEMETRY_TOPIC, text);
+      accepted[outSeq++] = outboxPush(1, msg);
+      if (!accepted[outSeq - 1]) r.outRejected++;
+    }
+    while ((long)(now - nextCmd) >= 0 && inSeq < maxSeq) {
+      nextCmd += CMD_EVERY_MS;
+      snprintf(text, sizeof(text), "%zu", inSeq++);
+      broker.publish(COMMAND_TOPIC, text);
+    }
+  };
+
+  unsigned long faultAt = now + WARMUP_MS + phaseMs;
+  unsigned long stopAt = faultAt + GIVE_UP_MS;
+  bool injected = false;
+  while ((long)(now - stopAt) < 0) {
+    traffic();
+    device.tick();
+    if (!injected && (long)(now - faultAt) >= 0) {
+      scenario.inject();
+      faultAt = now;
+      injected = true;
+    }
+    if (!injected) continue;
+    if (!r.dropped && !isMqttConnected()) {
+      r.dropped = true;
+      r.detectMs = now - faultAt;
+    }
+    if (r.dropped && !r.recovered && device.ready()) {
+      r.recovered = true;
+      r.readyMs = now - faultAt;
+      stopAt = now + SETTLE_MS;
+    }
+    if (!r.dropped && now - faultAt > SETTLE_MS * 2) break;  // Sin caída
+  }
+  scenario.clear();
+
+  // Dejar salir lo que quede en el Outbox antes de contar
+  size_t inSent = inSeq;
+  for (int i = 0; i < 100 && outboxDepth(1) > 0; i++) device.tick();
+  for (int i = 0; i < 10; i++) device.tick();
+
+  for (size_t i = 0; i < outSeq; i++) {
+    if (!accepted[i]) continue;
+    r.outSent++;
+    if (!atBroker[i]) r.outLost++;
+  }
+  r.inSent = inSent;
+  for (size_t i = 0; i < inSent; i++) {
+    if (!atDevice[i]) r.inLost++;
+  }
+  r.failCount = device.worstFailCount;
+  return r;
+}
+
+static unsigned long median(std::vector<unsigned long> v) {
+  std::sort(v.begin(), v.end());
+  return v[v.size() / 2];
+}
+
+static bool check(bool ok, const char* what) {
+  if (!ok) printf("FAIL %s\n", what);
+  return ok;
+}
+
+int main() {
+  broker.setLatency(LATENCY_MS);
+  broker.onPublish(onBrokerPublish, nullptr);
+  setMqttMessageCallback(onDeviceMessage);
+  mqttBegin();
+  mqttSubscribe(COMMAND_TOPIC, 0);
+
+  // Primera conexión
+  for (int i = 0; i < 100 && !device.ready(); i++) device.tick();
+  if (!check(device.ready(), "primera conexión")) return 1;
+
+  printf("%-22s %6s %22s %22s %14s %14s %7s\n", "escenario", "caídas", "detección ms",
+         "lista de nuevo ms", "salida perd.", "entrada perd.", "fallos");
+  printf("%-22s %6s %22s %22s %14s %14s %7s\n", "", "", "mín/mediana/máx", "mín/mediana/máx",
+         "perd./acept.", "perd./envi.", "seguidos");
+
+  bool ok = true;
+  for (const Scenario& scenario : scenarios) {
+    std::vector<unsigned long> detect, readyAgain;
+    size_t drops = 0, outSent = 0, outLost = 0, inSent = 0, inLost = 0;
+    int fails = 0;
+    bool allRecovered = true;
+
+    for (int run = 0; run < RUNS; run++) {
+      // El fallo cae en distintos puntos de los temporizadores de keepalive
+      RunResult r = runOnce(scenario, run * 1731);
+      if (r.dropped) {
+        drops++;
+        detect.push_back(r.detectMs);
+        if (r.recovered) readyAgain.push_back(r.readyMs);
+        else allRecovered = false;
+      }
+      outSent += r.outSent;
+      outLost += r.outLost;
+      inSent += r.inSent;
+      inLost += r.inLost;
+      fails = std::max(fails, r.failCount);
+    }
+
+    char detectText[32] = "-", readyText[32] = "-";
+    if (!detect.empty()) {
+      snprintf(detectText, sizeof(detectText), "%lu/%lu/%lu",
+               *std::min_element(detect.begin(), detect.end()), median(detect),
+               *std::max_element(detect.begin(), detect.end()));
+    }
+    if (!readyAgain.empty()) {
+      snprintf(readyText, sizeof(readyText), "%lu/%lu/%lu",
+               *std::min_element(readyAgain.begin(), readyAgain.end()), median(readyAgain),
+               *std::max_element(readyAgain.begin(), readyAgain.end()));
+    }
+    char outText[24], inText[24], dropText[16];
+    snprintf(outText, sizeof(outText), "%zu/%zu", outLost, outSent);
+    snprintf(inText, sizeof(inText), "%zu/%zu", inLost, inSent);
+    snprintf(dropText, sizeof(dropText), "%zu/%d", drops, RUNS);
+    printf("%-22s %6s %22s %22s %14s %14s %7d\n", scenario.name, dropText, detectText, readyText,
+           outText, inText, fails);
+
+    ok &= check(allRecovered, "la conexión vuelve tras cada caída");
+    if (drops == 0) ok &= check(outLost == 0 && inLost == 0, "sin caída no se pierde nada");
+    ok &= check(device.ready(), "lista al terminar el escenario");
+  }
+  return ok ? 0 : 1;
+}
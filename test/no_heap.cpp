@@ -0,0 +1,287 @@
+// Sin heap tras el arranque con IOTCONNECT_STATIC_ALLOC (host). malloc y
+// operator new se sustituyen por versiones que abortan en cuanto se arman.
+// Tras preparar todo se arman y durante cinco minutos simulados se recorre
+// lo que la librería promete sin reservas: publicar por el Outbox, por
+// LatestValues y por Telemetry, recibir del broker hasta la cola de entrada
+// (back/commit en el callback de MqttConnection, front/drop al entregar),
+// RPC en los dos sentidos y reconectar tras RST, enlace medio abierto y
+// reinicio del broker.
+//
+// Los fakes no reservan memoria; en el ESP32 el core de Arduino sí lo hace al
+// reconectar (WiFiClient, WiFi), y eso queda fuera de esta prueba.
+#include "../src/MqttClient.h"
+#include "../src/Outbox.h"
+#include "../src/RingBuffer.h"
+#include "../src/LatestValues.h"
+#include "../src/Telemetry.h"
+#include "../src/Rpc.h"
+#include "FakeBroker.h"
+#include <new>
+#include <unistd.h>
+
+#ifndef IOTCONNECT_STATIC_ALLOC
+#error "no_heap se compila con -DIOTCONNECT_STATIC_ALLOC"
+#endif
+
+// ---------------------------------------------------------------------------
+// Reservas vigiladas
+// ---------------------------------------------------------------------------
+extern "C" void* __libc_malloc(size_t);
+extern "C" void* __libc_calloc(size_t, size_t);
+extern "C" void* __libc_realloc(void*, size_t);
+extern "C" void __libc_free(void*);
+
+static bool armed = false;
+
+// Sin printf: podría reservar
+static void trap(const char* what) {
+  static const char prefix[] = "FAIL reserva de memoria tras el arranque: ";
+  ssize_t ignored = write(2, prefix, sizeof(prefix) - 1);
+  ignored = write(2, what, strlen(what));
+  ignored = write(2, "\n", 1);
+  (void)ignored;
+  abort();
+}
+
+extern "C" void* malloc(size_t size) {
+  if (armed) trap("malloc");
+  return __libc_malloc(size);
+}
+extern "C" void* calloc(size_t count, size_t size) {
+  if (armed) trap("calloc");
+  return __libc_calloc(count, size);
+}
+extern "C" void* realloc(void* ptr, size_t size) {
+  if (armed) trap("realloc");
+  return __libc_realloc(ptr, size);
+}
+extern "C" void free(void* ptr) { __libc_free(ptr); }
+
+void* operator new(size_t size) {
+  if (armed) trap("operator new");
+  if (void* ptr = __libc_malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+void* operator new[](size_t size) {
+  if (armed) trap("operator new[]");
+  if (void* ptr = __libc_malloc(size ? size : 1)) return ptr;
+  throw std::bad_alloc();
+}
+void operator delete(void* ptr) noexcept { __libc_free(ptr); }
+void operator delete[](void* ptr) noexcept { __libc_free(ptr); }
+void operator delete(void* ptr, size_t) noexcept { __libc_free(ptr); }
+void operator delete[](void* ptr, size_t) noexcept { __libc_free(ptr); }
+
+// ---------------------------------------------------------------------------
+// Dispositivo
+// ---------------------------------------------------------------------------
+static unsigned long now = 0;
+unsigned long millis() { return now; }
+void delay(unsigned long ms) { now += ms; }
+
+static constexpr unsigned long RUN_MS = 300000;
+static constexpr unsigned long TICK_MS = 100;
+static constexpr unsigned long RETRY_MS = 5000;
+static constexpr uint8_t OUTBOX_NORMAL = 1;   // MqttPriority::Normal
+
+static FakeBroker broker;
+static AppConfig cfg = {"ssid", "pass", "dev1", "token", "dev", true};
+
+// Lo mismo que IoTConnect: el callback de red escribe en su sitio y loop()
+// entrega desde la cola
+using MessageCallback = StaticCallback<void(const char* topic, const char* payload)>;
+static RingBuffer<MqttMessage, MQTT_INBOUND_QUEUE_LEN> inboundQueue;
+static MessageCallback onMessage;
+static uint32_t inboundDropped = 0;
+
+static void handleIncoming(const char* topic, const uint8_t* payload, unsigned int length) {
+  MqttMessage* slot = inboundQueue.back();
+  if (!slot) {
+    inboundDropped++;
+    return;
+  }
+  if (fillMqttMessage(*slot, topic, payload, length)) inboundQueue.commit();
+}
+
+static void dispatchPending() {
+  while (const MqttMessage* msg = inboundQueue.front()) {
+    if (!rpcHandle(msg->topic, msg->payload) && onMessage) onMessage(msg->topic, msg->payload);
+    inboundQueue.drop();
+  }
+}
+
+struct Counters {
+  uint32_t commands = 0;       // Comandos entregados a onMessage
+  uint32_t rpcServed = 0;      // Peticiones atendidas por el handler
+  uint32_t rpcReplies = 0;     // Respuestas a rpcCall
+  uint32_t reconnects = 0;
+  uint32_t atBrokerOutbox = 0;
+  uint32_t atBrokerLatest = 0;
+  uint32_t atBrokerTelemetry = 0;
+  uint32_t atBrokerRpc = 0;
+};
+static Counters counters;
+
+// Llamadas del dispositivo pendientes de respuesta del servidor
+static char pendingCalls[8][16];
+static size_t pendingCallCount = 0;
+
+static void onBrokerPublish(void*, const char* topic, const uint8_t* payload, size_t length) {
+  if (strcmp(topic, "dev/normal") == 0) counters.atBrokerOutbox++;
+  else if (strcmp(topic, "dev/latest") == 0) counters.atBrokerLatest++;
+  else if (strcmp(topic, "dev/tlm") == 0) counters.atBrokerTelemetry++;
+  else if (strcmp(topic, "dev/rpc/res/echo") == 0) counters.atBrokerRpc++;
+  else if (strncmp(topic, "dev/rpc/call/", 13) == 0 && pendingCallCount < 8) {
+    // "<id>|args": el servidor contesta fuera del hook
+    size_t idLen = 0;
+    while (idLen < length && idLen < 15 && payload[idLen] != '|') idLen++;
+    memcpy(pendingCalls[pendingCallCount], payload, idLen);
+    pendingCalls[pendingCallCount++][idLen] = '\0';
+  }
+}
+
+static bool wasConnected = false;
+static unsigned long lastRetry = 0;
+
+static bool ready() { return wasConnected && isMqttConnected() && isMqttStable(); }
+
+// La parte de red de IoTConnect.loop() sin task de red
+static void tick() {
+  if (isMqttConnected()) {
+    mqttLoop();
+    if (!wasConnected) {
+      for (int i = 0; i < 20 && isMqttConnected(); i++) {
+        mqttLoop();
+        delay(50);
+      }
+      wasConnected = isMqttConnected();
+      if (wasConnected) counters.reconnects++;
+    }
+  } else {
+    wasConnected = false;
+    if (now - lastRetry > RETRY_MS) {
+      lastRetry = now;
+      mqttConnect(cfg);
+    }
+  }
+  outboxService(OUTBOX_BURST);
+  latestSendPending();
+  telemetryService(ready());
+  rpcSweep();
+  dispatchPending();
+  delay(TICK_MS);
+}
+
+static bool check(bool ok, const char* what) {
+  printf("%s %s\n", ok ? "OK  " : "FAIL", what);
+  return ok;
+}
+
+int main() {
+  // Arranque: aquí sí se puede reservar (stdout, primeras conexiones)
+  printf("Preparando...\n");
+  broker.setLatency(20);
+  broker.onPublish(onBrokerPublish, nullptr);
+  setMqttMessageCallback(handleIncoming);
+  onMessage = [](const char*, const char*) { counters.commands++; };
+  mqttBegin();
+  mqttSubscribe("dev/cmd", 0);
+  rpcBegin("dev", mqttSubscribe);
+  rpcOn("echo", [](const char* args, char* result, size_t resultSize) {
+    counters.rpcServed++;
+    strlcpy(result, args, resultSize);
+    return RPC_OK;
+  });
+  int channel = telemetryAddChannel("dev/tlm", 10000, 0, TelemetryEncoding::Delta, 0.1f);
+  for (int i = 0; i < 100 && !ready(); i++) tick();
+  if (!check(ready() && channel >= 0, "conectado antes de armar")) return 1;
+  counters = Counters();
+
+  armed = true;
+  unsigned long start = now;
+  unsigned long nextNormal = now, nextLatest = now, nextSample = now, nextCall = now;
+  unsigned long nextCommand = now, nextRequest = now;
+  bool resetDone = false, halfOpenDone = false, restartDone = false;
+  uint32_t seq = 0;
+  char text[32];
+
+  while (now - start < RUN_MS) {
+    unsigned long elapsed = now - start;
+    if (!resetDone && elapsed >= 60000) {
+      broker.reset();
+      resetDone = true;
+    }
+    if (!halfOpenDone && elapsed >= 120000) {
+      broker.halfOpen();
+      halfOpenDone = true;
+    }
+    if (!restartDone && elapsed >= 200000) {
+      broker.restart(5000);
+      restartDone = true;
+    }
+
+    // App
+    if ((long)(now - nextNormal) >= 0) {
+      nextNormal += 200;
+      if (ready()) {
+        static MqttMessage msg;
+        snprintf(text, sizeof(text), "%u", (unsigned)seq++);
+        fillMqttMessage(msg, "dev/normal", text);
+        outboxPush(OUTBOX_NORMAL, msg);
+      }
+    }
+    if ((long)(now - nextLatest) >= 0) {
+      nextLatest += 100;
+      snprintf(text, sizeof(text), "%u", (unsigned)seq++);
+      latestStore("dev/latest", text);
+    }
+    if ((long)(now - nextSample) >= 0) {
+      nextSample += 50;
+      telemetryRecord(channel, 20.0f + (seq % 40) * 0.1f);
+    }
+    if ((long)(now - nextCall) >= 0) {
+      nextCall += 2000;
+      if (ready()) rpcCall("ping", "x", 5000, [](int code, const char*) {
+        if (code == RPC_OK) counters.rpcReplies++;
+      });
+    }
+
+    // Servidor
+    if ((long)(now - nextCommand) >= 0) {
+      nextCommand += 300;
+      snprintf(text, sizeof(text), "%u", (unsigned)seq++);
+      broker.publish("dev/cmd", text);
+    }
+    if ((long)(now - nextRequest) >= 0) {
+      nextRequest += 1000;
+      snprintf(text, sizeof(text), "%u|hola", (unsigned)seq++);
+      broker.publish("dev/rpc/req/echo", text);
+    }
+    for (size_t i = 0; i < pendingCallCount; i++) {
+      snprintf(text, sizeof(text), "%.15s|0|pong", pendingCalls[i]);
+      broker.publish("dev/rpc/ret", text);
+    }
+    pendingCallCount = 0;
+
+    tick();
+  }
+  armed = false;
+
+  printf("%lu s simulados sin reservas: %u reconexiones, %u comandos, %u RPC atendidas, "
+         "%u respuestas a rpcCall, %u mensajes de entrada descartados\n",
+         (now - start) / 1000, (unsigned)counters.reconnects, (unsigned)counters.commands,
+         (unsigned)counters.rpcServed, (unsigned)counters.rpcReplies, (unsigned)inboundDropped);
+  printf("En el broker: %u Outbox, %u LatestValues, %u Telemetry, %u respuestas RPC\n",
+         (unsigned)counters.atBrokerOutbox, (unsigned)counters.atBrokerLatest,
+         (unsigned)counters.atBrokerTelemetry, (unsigned)counters.atBrokerRpc);
+
+  bool ok = true;
+  ok &= check(counters.reconnects >= 3, "reconecta tras RST, medio abierto y reinicio");
+  ok &= check(counters.commands > 0, "entrega comandos del broker");
+  ok &= check(counters.rpcServed > 0 && counters.atBrokerRpc > 0, "atiende y responde RPC");
+  ok &= check(counters.rpcReplies > 0, "recibe respuestas a rpcCall");
+  ok &= check(counters.atBrokerOutbox > 0, "publica por el Outbox");
+  ok &= check(counters.atBrokerLatest > 0, "publica por LatestValues");
+  ok &= check(counters.atBrokerTelemetry > 0, "publica por Telemetry");
+  return ok ? 0 : 1;
+}
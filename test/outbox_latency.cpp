@@ -0,0 +1,120 @@
+// Latencia de lo crítico en el Outbox con la cola bulk saturada (host). El
+// envío se simula: cada publicación avanza el reloj PUBLISH_MS. Comprueba
+// que una alarma sale en la primera publicación del siguiente servicio por
+// mucho bulk que haya, que normal y bulk se reparten según sus pesos y que
+// una conexión secundaria caída no frena a la principal.
+#include "../src/Outbox.h"
+#include <string>
+#include <vector>
+
+static unsigned long now = 0;
+unsigned long millis() { return now; }
+void delay(unsigned long ms) { now += ms; }
+
+// Sustitutos de MqttClient: "sec/..." va por la conexión 1. No hay
+// mqttPublish(): si el Outbox volviera a usarlo (con sus esperas de
+// estabilización por mensaje) esta prueba no enlazaría.
+static constexpr unsigned long PUBLISH_MS = 2;
+static bool stable[MQTT_MAX_CONNECTIONS];
+static std::vector<std::string> sent;
+
+uint8_t mqttRouteFor(const char* topic) { return strncmp(topic, "sec/", 4) == 0 ? 1 : 0; }
+bool isMqttStableAt(uint8_t index) { return index < MQTT_MAX_CONNECTIONS && stable[index]; }
+bool isMqttConnectedFor(const char* topic) { return stable[mqttRouteFor(topic)]; }
+
+bool mqttSend(const char* topic, const char*, bool) {
+  if (!stable[mqttRouteFor(topic)]) return false;
+  now += PUBLISH_MS;
+  sent.push_back(topic);
+  return true;
+}
+
+static bool push(uint8_t cls, const char* topic) {
+  static MqttMessage msg;
+  strlcpy(msg.topic, topic, sizeof(msg.topic));
+  strlcpy(msg.payload, "x", sizeof(msg.payload));
+  msg.length = 1;
+  msg.retained = false;
+  return outboxPush(cls, msg);
+}
+
+static void drain() {
+  while (outboxService(OUTBOX_BURST) > 0) {}
+  sent.clear();
+}
+
+static bool check(bool ok, const char* what) {
+  printf("%s %s\n", ok ? "OK  " : "FAIL", what);
+  return ok;
+}
+
+// Bulk (y normal) siempre llenos; una alarma cada pocas vueltas de loop()
+static bool alarmUnderBulk() {
+  unsigned long worst = 0;
+  size_t alarms = 0, bulk = 0, normal = 0;
+  unsigned long pushedAt = 0;
+  bool waiting = false;
+
+  for (int tick = 0; tick < 5000; tick++) {
+    while (push(2, "bulk")) {}
+    while (push(1, "normal")) {}
+    if (!waiting && tick % 7 == 3) {
+      if (!push(0, "alarm")) return check(false, "alarma encolada");
+      pushedAt = now;
+      waiting = true;
+    }
+
+    sent.clear();
+    outboxService(OUTBOX_BURST);
+    unsigned long t = pushedAt;
+    for (auto& topic : sent) {
+      t += PUBLISH_MS;
+      if (topic == "alarm") {
+        if (t - pushedAt > worst) worst = t - pushedAt;
+        alarms++;
+        waiting = false;
+      } else if (topic == "bulk") {
+        bulk++;
+      } else {
+        normal++;
+      }
+    }
+    now += 1;  // Resto de loop()
+  }
+  drain();
+
+  printf("     %zu alarmas, peor latencia %lu ms; normal %zu, bulk %zu\n", alarms, worst, normal, bulk);
+  bool ok = check(alarms > 0 && !waiting && worst <= PUBLISH_MS, "alarma en la primera publicación");
+  ok &= check(bulk > 0 && normal >= bulk * 3 && normal <= bulk * 5, "normal/bulk según pesos 4:1");
+  return ok;
+}
+
+static bool secondaryDown() {
+  stable[1] = false;
+  push(0, "sec/alarm");
+  push(0, "alarm");
+  for (int i = 0; i < 4; i++) push(2, "sec/bulk");
+  push(2, "bulk");
+  push(1, "normal");
+  outboxService(OUTBOX_BURST);
+
+  bool ok = check(sent.size() == 2 && sent[0] == "alarm" && sent[1] == "normal",
+                  "con la secundaria caída sale lo de la principal");
+  // Apartados llenos: bulk espera detrás de sec/bulk, nada se pierde
+  ok &= check(outboxDepth(0) == 1 && outboxDepth(2) == 5, "lo de la secundaria sigue pendiente");
+
+  stable[1] = true;
+  sent.clear();
+  while (outboxService(OUTBOX_BURST) > 0) {}
+  ok &= check(sent.size() == 6 && sent[0] == "sec/alarm", "al volver sale en orden");
+  ok &= check(outboxDepth(0) == 0 && outboxDepth(2) == 0, "colas vacías");
+  sent.clear();
+  return ok;
+}
+
+int main() {
+  stable[0] = stable[1] = true;
+  bool ok = alarmUnderBulk();
+  ok &= secondaryDown();
+  return ok ? 0 : 1;
+}
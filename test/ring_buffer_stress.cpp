@@ -0,0 +1,89 @@
+// Prueba de estrés de RingBuffer (host): un productor y un consumidor en
+// threads distintos, muchas vueltas al buffer. Comprueba que los elementos
+// salen en orden, sin pérdidas ni duplicados, por push/pop y escribiendo y
+// leyendo en el hueco (back/commit y front/drop).
+#include "../src/RingBuffer.h"
+#include <cstdint>
+#include <cstdio>
+#include <thread>
+
+static constexpr uint64_t COUNT = 2000000;
+
+// Más grande que una palabra: una copia a medias se notaría en check
+struct Item {
+  uint64_t seq;
+  uint64_t check;
+};
+
+static uint64_t mix(uint64_t seq) { return seq * 0x9E3779B97F4A7C15ULL ^ 0xA5A5A5A5A5A5A5A5ULL; }
+
+template <size_t N>
+static bool run(bool zeroCopy) {
+  static RingBuffer<Item, N> ring;
+  uint64_t errors = 0;
+
+  std::thread producer([zeroCopy] {
+    for (uint64_t seq = 0; seq < COUNT;) {
+      if (zeroCopy) {
+        Item* slot = ring.back();
+        if (!slot) {
+          std::this_thread::yield();
+          continue;
+        }
+        slot->seq = seq;
+        slot->check = mix(seq);
+        ring.commit();
+        seq++;
+      } else if (ring.push(Item{seq, mix(seq)})) {
+        seq++;
+      } else {
+        std::this_thread::yield();
+      }
+    }
+  });
+
+  std::thread consumer([&errors, zeroCopy] {
+    uint64_t expected = 0;
+    while (expected < COUNT) {
+      Item item;
+      if (zeroCopy) {
+        Item* next = ring.front();
+        if (!next) {
+          std::this_thread::yield();
+          continue;
+        }
+        item = *next;
+        ring.drop();
+      } else if (!ring.pop(item)) {
+        std::this_thread::yield();
+        continue;
+      }
+      if (item.seq != expected || item.check != mix(item.seq)) {
+        if (errors++ < 5) {
+          fprintf(stderr, "  esperado %llu, llegó %llu\n", (unsigned long long)expected,
+                  (unsigned long long)item.seq);
+        }
+        expected = item.seq;  // Seguir desde ahí para no contar en cascada
+      }
+      expected++;
+    }
+  });
+
+  producer.join();
+  consumer.join();
+
+  bool ok = errors == 0 && ring.empty();
+  printf("%s N=%zu %s: %llu elementos, %llu errores\n", ok ? "OK  " : "FAIL", N,
+         zeroCopy ? "back/commit + front/drop" : "push/pop", (unsigned long long)COUNT,
+         (unsigned long long)errors);
+  return ok;
+}
+
+int main() {
+  bool ok = true;
+  ok &= run<2>(false);
+  ok &= run<8>(false);
+  ok &= run<8>(true);
+  ok &= run<64>(true);
+  return ok ? 0 : 1;
+}
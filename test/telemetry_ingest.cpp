@@ -0,0 +1,135 @@
+// Coste por muestra de Telemetry (host). Mide telemetryRecord() solo y con
+// telemetryService() cerrando ventanas, formateando y encolando en el
+// Outbox, para las codificaciones JSON y Delta. Lo compara con publicar
+// cada muestra en su propio mensaje, que es lo que Telemetry sustituye.
+// El envío se simula: mqttSend() solo cuenta mensajes y bytes.
+#include "../src/Telemetry.h"
+#include "../src/Outbox.h"
+#include <chrono>
+
+static unsigned long now = 0;
+unsigned long millis() { return now; }
+void delay(unsigned long ms) { now += ms; }
+
+// Sustitutos de MqttClient: todo va por una conexión siempre estable
+static size_t sentMessages = 0;
+static size_t sentBytes = 0;
+
+uint8_t mqttRouteFor(const char*) { return 0; }
+bool isMqttStableAt(uint8_t index) { return index == 0; }
+bool isMqttConnectedFor(const char*) { return true; }
+
+bool mqttSend(const char*, const char* payload, bool) {
+  sentMessages++;
+  sentBytes += strlen(payload);
+  return true;
+}
+
+// Igual que en MqttClient.cpp
+bool fillMqttMessage(MqttMessage& msg, const char* topic, const char* payload, bool retained) {
+  size_t topicLen = strlen(topic);
+  size_t length = strlen(payload);
+  if (topicLen >= sizeof(msg.topic) || length > MQTT_PAYLOAD_MAX) return false;
+  memcpy(msg.topic, topic, topicLen + 1);
+  memcpy(msg.payload, payload, length + 1);
+  msg.length = length;
+  msg.retained = retained;
+  return true;
+}
+
+static constexpr uint32_t SAMPLES = 2000000;
+static constexpr uint16_t WINDOW_SAMPLES = 100;
+static constexpr uint32_t SERVICE_EVERY = 10;    // Muestras por vuelta de loop()
+static constexpr uint8_t OUTBOX_BULK = 2;
+
+using Clock = std::chrono::steady_clock;
+
+static double nsPerSample(Clock::time_point start, uint32_t samples) {
+  return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / samples;
+}
+
+// Señal que varía poco, como un sensor real
+static inline float sample(uint32_t i) {
+  return 21.0f + (float)((i * 2654435761u) >> 28) * 0.05f;
+}
+
+static bool check(bool ok, const char* what) {
+  printf("%s %s\n", ok ? "OK  " : "FAIL", what);
+  return ok;
+}
+
+struct Result {
+  double recordNs;    // Solo telemetryRecord()
+  double totalNs;     // Con service, formato, Outbox y envío
+  size_t messages;
+  size_t bytes;
+};
+
+static Result measure(const char* topic, TelemetryEncoding encoding) {
+  Result r = {};
+  int recordOnly = telemetryAddChannel(topic, 0, WINDOW_SAMPLES, encoding, 0.01f);
+  int full = telemetryAddChannel(topic, 0, WINDOW_SAMPLES, encoding, 0.01f);
+  if (recordOnly < 0 || full < 0) return r;
+
+  // Sin service las ventanas cerradas solo se funden: es el camino de record()
+  auto start = Clock::now();
+  for (uint32_t i = 0; i < SAMPLES; i++) telemetryRecord(recordOnly, sample(i));
+  r.recordNs = nsPerSample(start, SAMPLES);
+  telemetryService(true);
+  while (outboxService(OUTBOX_BURST) > 0) {}
+
+  sentMessages = sentBytes = 0;
+  start = Clock::now();
+  for (uint32_t i = 0; i < SAMPLES; i++) {
+    telemetryRecord(full, sample(i));
+    if (i % SERVICE_EVERY == SERVICE_EVERY - 1) {
+      telemetryService(true);
+      outboxService(OUTBOX_BURST);
+    }
+  }
+  r.totalNs = nsPerSample(start, SAMPLES);
+  r.messages = sentMessages;
+  r.bytes = sentBytes;
+  return r;
+}
+
+// Lo que hace la app sin Telemetry: un publish() por muestra, que sale enseguida
+static Result measurePerSample() {
+  Result r = {};
+  static MqttMessage msg;
+  char payload[16];
+  sentMessages = sentBytes = 0;
+  auto start = Clock::now();
+  for (uint32_t i = 0; i < SAMPLES; i++) {
+    snprintf(payload, sizeof(payload), "%g", sample(i));
+    if (fillMqttMessage(msg, "raw", payload)) outboxPush(OUTBOX_BULK, msg);
+    outboxService(1);
+  }
+  r.recordNs = r.totalNs = nsPerSample(start, SAMPLES);
+  r.messages = sentMessages;
+  r.bytes = sentBytes;
+  return r;
+}
+
+static void report(const char* name, const Result& r) {
+  printf("     %-16s record %6.1f ns/muestra, total %6.1f ns/muestra, %8zu mensajes, "
+         "%6.2f bytes/muestra\n",
+         name, r.recordNs, r.totalNs, r.messages, (double)r.bytes / SAMPLES);
+}
+
+int main() {
+  Result json = measure("tlm/json", TelemetryEncoding::Json);
+  Result delta = measure("tlm/delta", TelemetryEncoding::Delta);
+  Result raw = measurePerSample();
+  printf("     %u muestras, ventanas de %u, telemetryService() cada %u\n", (unsigned)SAMPLES,
+         (unsigned)WINDOW_SAMPLES, (unsigned)SERVICE_EVERY);
+  report("JSON", json);
+  report("Delta", delta);
+  report("una por muestra", raw);
+
+  bool ok = check(json.messages == SAMPLES / WINDOW_SAMPLES, "JSON: un registro por ventana");
+  ok &= check(delta.messages == SAMPLES / WINDOW_SAMPLES, "Delta: un registro por ventana");
+  ok &= check(delta.bytes < json.bytes, "Delta ocupa menos que JSON");
+  ok &= check(raw.messages == SAMPLES, "sin Telemetry sale un mensaje por muestra");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+// Traza de conexión exportada en JSON trace_event de Chrome (host). Con
+// IOTCONNECT_TRACE, MqttClient se conecta a FakeBroker, publica por los dos
+// caminos (mqttPublish y Outbox), pierde la conexión por un RST y vuelve.
+// La traza se vuelca a trace_export.json (abrir en ui.perfetto.dev o
+// chrome://tracing) y se publica por MQTT como publishTrace(); las dos
+// copias tienen que coincidir.
+#include "../src/MqttClient.h"
+#include "../src/Outbox.h"
+#include "../src/Trace.h"
+#include "FakeBroker.h"
+#include <string>
+#include <vector>
+
+#ifndef IOTCONNECT_TRACE
+#error "trace_export se compila con -DIOTCONNECT_TRACE"
+#endif
+
+static unsigned long now = 0;
+unsigned long millis() { return now; }
+unsigned long micros() { return now * 1000; }
+void delay(unsigned long ms) { now += ms; }
+
+static constexpr unsigned long LATENCY_MS = 30;
+static const char* const OUTPUT_FILE = "trace_export.json";
+
+static FakeBroker broker;
+static AppConfig cfg = {"ssid", "pass", "dev1", "token", "dev", true};
+static std::string published;
+
+static void onBrokerPublish(void*, const char* topic, const uint8_t* payload, size_t length) {
+  if (strcmp(topic, "dev/trace") == 0) published.assign((const char*)payload, length);
+}
+
+class StringPrint : public Print {
+public:
+  std::string text;
+  size_t write(uint8_t b) override {
+    text += (char)b;
+    return 1;
+  }
+};
+
+class CountingPrint : public Print {
+public:
+  size_t write(uint8_t) override { return 1; }
+  size_t write(const uint8_t*, size_t size) override { return size; }
+};
+
+// Como publishTraceNow() en IoTConnect.cpp
+static bool publishTrace(const char* topic) {
+  traceSetPaused(true);
+  CountingPrint counter;
+  bool ok = mqttPublishStream(topic, traceDump(counter), traceDump);
+  traceSetPaused(false);
+  return ok;
+}
+
+struct Span {
+  std::string name;
+  unsigned long ts;
+  unsigned long dur;
+};
+
+// Lo justo para leer lo que escribe traceDump()
+static std::vector<Span> parseSpans(const std::string& json) {
+  std::vector<Span> spans;
+  size_t pos = 0;
+  while ((pos = json.find("{\"name\":\"", pos)) != std::string::npos) {
+    pos += 9;
+    size_t end = json.find('"', pos);
+    Span span;
+    span.name = json.substr(pos, end - pos);
+    span.ts = strtoul(json.c_str() + json.find("\"ts\":", end) + 5, nullptr, 10);
+    span.dur = strtoul(json.c_str() + json.find("\"dur\":", end) + 6, nullptr, 10);
+    spans.push_back(span);
+    pos = end;
+  }
+  return spans;
+}
+
+static size_t countSpans(const std::vector<Span>& spans, const char* name) {
+  size_t n = 0;
+  for (auto& span : spans) n += span.name == name;
+  return n;
+}
+
+static bool check(bool ok, const char* what) {
+  printf("%s %s\n", ok ? "OK  " : "FAIL", what);
+  return ok;
+}
+
+int main() {
+  broker.setLatency(LATENCY_MS);
+  broker.onPublish(onBrokerPublish, nullptr);
+  mqttBegin();
+  mqttSubscribe("dev/cmd", 0);
+
+  bool ok = check(mqttConnect(cfg), "conecta");
+  publishOkSync(cfg);
+  mqttPublish("dev/status", "online");
+
+  static MqttMessage msg;
+  fillMqttMessage(msg, "dev/data", "42");
+  outboxPush(1, msg);
+  while (outboxService(OUTBOX_BURST) > 0) {}
+
+  // RST y reconexión
+  broker.reset();
+  for (int i = 0; i < 100 && isMqttConnected(); i++) {
+    mqttLoop();
+    delay(10);
+  }
+  ok &= check(!isMqttConnected(), "ve el RST");
+  delay(5000);
+  ok &= check(mqttConnect(cfg), "reconecta");
+  mqttPublish("dev/status", "online");
+
+  StringPrint dump;
+  traceSetPaused(true);
+  size_t length = traceDump(dump);
+  traceSetPaused(false);
+  if (FILE* f = fopen(OUTPUT_FILE, "w")) {
+    fwrite(dump.text.data(), 1, dump.text.size(), f);
+    fclose(f);
+  }
+
+  std::vector<Span> spans = parseSpans(dump.text);
+  printf("     %zu tramos, %zu bytes en %s\n", spans.size(), length, OUTPUT_FILE);
+  for (auto& span : spans) {
+    printf("     %-20s %8lu ms  %6lu ms\n", span.name.c_str(), span.ts / 1000, span.dur / 1000);
+  }
+
+  ok &= check(length == dump.text.size() && dump.text.rfind("{\"traceEvents\":[", 0) == 0 &&
+              dump.text.back() == '}', "JSON trace_event completo");
+  ok &= check(countSpans(spans, "mqtt.connect") == 2, "un mqtt.connect por conexión");
+  ok &= check(countSpans(spans, "mqtt.settle") == 2 && countSpans(spans, "mqtt.sync") == 1 &&
+              countSpans(spans, "mqtt.publish") == 2 && countSpans(spans, "mqtt.send") == 3,
+              "tramos de estabilización, sync y publicación");
+  bool connectRtt = true;
+  for (auto& span : spans) {
+    if (span.name == "mqtt.connect") connectRtt &= span.dur >= 2 * LATENCY_MS * 1000;
+  }
+  ok &= check(connectRtt, "mqtt.connect incluye la ida y vuelta del CONNACK");
+
+  ok &= check(publishTrace("dev/trace"), "publishTrace");
+  for (int i = 0; i < 20; i++) {
+    mqttLoop();
+    delay(10);
+  }
+  ok &= check(published == dump.text, "por MQTT llega la misma traza");
+  return ok ? 0 : 1;
+}